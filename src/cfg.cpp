@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cassert>
+#include <deque>
 #include <iostream>
 #include <set>
 #include <optional>
@@ -6,136 +8,59 @@
 #include <sstream>
 #include "cfg.hpp"
 #include "common.hpp"
+#include "diagnostics.hpp"
 #include "mav.hpp"
 using namespace std;
 
-#define MAX_DEPTH 8
-
-static vector<FunctionSummary> get_fn_summaries(const string &fn, 
-                                                const unordered_map<string, set<unsigned>> &name_to_tu,
-                                                const vector<map<string, FunctionSummary>> &fn_summaries) {
-        vector<FunctionSummary> s;
+static vector<const FunctionSummary *> get_fn_summaries(const string &fn,
+                                                        const unordered_map<string, set<unsigned>> &name_to_tu,
+                                                        const vector<map<string, FunctionSummary>> &fn_summaries) {
+        vector<const FunctionSummary *> s;
         const auto tus = name_to_tu.find(fn);
         if (tus == name_to_tu.end())
                 return s;
         for (unsigned tu: tus->second) {
-                if (tu > fn_summaries.size()) {
+                if (tu >= fn_summaries.size()) {
                         cerr << "get_fn_summaries(): invalid translation unit number" << endl;
                         continue;
                 }
                 const auto fs = fn_summaries[tu].find(fn);
                 if (fs != fn_summaries[tu].end())
-                        s.push_back(fs->second);
+                        s.push_back(&fs->second);
         }
         return s;
 }
 
-// Maps (function names, call information) to their traces of buggy stores.
-static unordered_map<string, unordered_map<vector<TypeInfo>, vector<vector<string>>, TypeInfoHash>> memoized_traces;
-
-// Maps variable names to their type.
-// For now, we just store the first type that was stored to the variable.
-// If types differ later, then we probably found a bug.
-// TODO: We could deduce what type is correct based on a majority voting scheme.
-static unordered_map<string, TypeInfo> variable_name_to_type;
-
-static vector<vector<string>> get_storage_trace(const string &fn,
-                                                set<string> &visited,
-                                                vector<vector<string>> &inconsistent_storage_traces,
-                                                const unordered_map<string, set<unsigned>> &name_to_tu,
-                                                const vector<map<string, FunctionSummary>> &fn_summaries,
-                                                const set<string> &fns_with_intrinsic_variables,
-                                                const vector<TypeInfo> &argtypes,
-                                                const map<string, TypeInfo> &prior_types,
-                                                int depth=0) {
-        auto memoized_map = memoized_traces.find(fn);
-        if (memoized_map != memoized_traces.end()) {
-                auto memoized_result = memoized_map->second.find(argtypes);
-                if (memoized_result != memoized_map->second.end()) {
-                        return memoized_result->second;
-                }
-        }
-
-        if (depth > MAX_DEPTH)
-                return {};
-
-        vector<FunctionSummary> summaries = get_fn_summaries(fn, name_to_tu, fn_summaries);
-        vector<vector<string>> results;
-        visited.insert(fn);
-        for (const auto &fs: summaries) {
-                // If we write to a global, add our name to the trace.
-                for (const auto &store: fs.store_to_typeinfo) {
-                        for (const auto &source: store.second.source) {
-                                TypeInfo variable_type = store.second;
-
-                                if (source.kind == SOURCE_PARAM) {
-                                        if ((size_t) source.param_no >= argtypes.size()) continue;
-
-				        assert((size_t) source.param_no < argtypes.size());
-                                        const TypeInfo &the_param = argtypes.at(source.param_no);
-
-                                        const auto &it = prior_types.find(store.first);
-                                        assert(it != prior_types.end());
-
-                                        // TODO: Only check types that were already known.
-                                        if (it->second != the_param) {
-                                                results.push_back({fn});
-                                        }
-                                        results.push_back({fn});
-
-                                        variable_type = the_param;
-                                }
-
-                                // Check if this store matches the type of a previous store.
-                                // If it doesn't, then we have found an inconsistent storage violation.
-                                const auto &previously_found_type = variable_name_to_type.find(store.first);
-                                if (previously_found_type != variable_name_to_type.end() &&
-                                        previously_found_type->second != variable_type) {
-                                                inconsistent_storage_traces.push_back({fn});
-                                } else {
-                                        variable_name_to_type[store.first] = store.second;
-                                }
+// Binds the arguments of a call site to the calling context of the caller.
+// An argument that is one of the caller's parameters takes on the type the
+// caller was called with, so types flow through chains of calls.
+static vector<TypeInfo> bind_arguments(const vector<TypeInfo> &call,
+                                       const vector<TypeInfo> &caller_argtypes) {
+        vector<TypeInfo> bound = call;
+        for (auto &arg: bound) {
+                for (const auto &source: arg.source) {
+                        if (source.kind == SOURCE_PARAM &&
+                            source.param_no >= 0 &&
+                            (size_t) source.param_no < caller_argtypes.size()) {
+                                arg = caller_argtypes[source.param_no];
+                                break;
                         }
                 }
+        }
+        return bound;
+}
 
-                // Iterate over each function we call.
-                for (const auto &ccs: fs.calling_context) {
-                        string callee_name = ccs.first;
-                        if (visited.find(callee_name) != visited.end())
-                                continue;
-
-                        // Iterate over each call site.
-                        for (const auto &call: ccs.second) {
-                                vector<vector<string>> callee_inconsistent_traces;
-                                vector<vector<string>> traces = get_storage_trace(
-                                        callee_name,
-                                        visited,
-                                        callee_inconsistent_traces,
-                                        name_to_tu,
-                                        fn_summaries,
-                                        fns_with_intrinsic_variables,
-                                        call,
-                                        prior_types,
-                                        depth+1
-                                );
-                                // Add fn to the front of every trace and add to our results.
-                                for (const auto &trace : traces) {
-                                        vector<string> new_trace = {fn};
-                                        new_trace.insert(new_trace.end(), trace.begin(), trace.end());
-                                        results.push_back(new_trace);
-                                }
-                                // Add fn to the front of every inconsistent storage trace.
-                                for (auto &inconsistent_trace : callee_inconsistent_traces) {
-                                        vector<string> new_trace = {fn};
-                                        new_trace.insert(new_trace.end(), inconsistent_trace.begin(), inconsistent_trace.end());
-                                        inconsistent_storage_traces.push_back(new_trace);
-                                }
-                        }
-                }
+// Returns the least upper bound of two calling contexts.
+static vector<TypeInfo> join_argtypes(const vector<TypeInfo> &a, const vector<TypeInfo> &b) {
+        vector<TypeInfo> joined = a.size() >= b.size() ? a : b;
+        const vector<TypeInfo> &other = a.size() >= b.size() ? b : a;
+        for (size_t i = 0; i < other.size(); i++) {
+                joined[i].frames.insert(other[i].frames.begin(), other[i].frames.end());
+                joined[i].units.insert(other[i].units.begin(), other[i].units.end());
+                if (joined[i].dimension != other[i].dimension)
+                        joined[i].dimension.reset();
         }
-        visited.erase(fn);
-        memoized_traces[fn][argtypes] = results;
-        return results;
+        return joined;
 }
 
 static vector<TypeInfo> get_initial_argtypes(const string &fn,
@@ -175,6 +100,257 @@ static vector<TypeInfo> get_initial_argtypes(const string &fn,
         return args;
 }
 
+TraceSolver::TraceSolver(const unordered_map<string, set<unsigned>> &name_to_tu,
+                         const vector<map<string, FunctionSummary>> &fn_summaries,
+                         const PathIndex &prior_types,
+                         int num_units,
+                         const ContextLimits &limits)
+        : name_to_tu(name_to_tu), fn_summaries(fn_summaries), prior_types(prior_types),
+          num_units(num_units), limits(limits) {}
+
+void TraceSolver::add_root(const string &fn) {
+        roots.push_back(get_node(fn, get_initial_argtypes(fn, name_to_tu, fn_summaries, num_units), 0));
+}
+
+void TraceSolver::solve() {
+        while (!worklist.empty()) {
+                int node = worklist.front();
+                worklist.pop_front();
+                process(node);
+        }
+        relink();
+}
+
+// Adds the traces in after but not in before to added, and the ones in
+// before but not in after to removed.
+static void diff_traces(const map<string, vector<string>> &before,
+                        const map<string, vector<string>> &after,
+                        map<string, vector<string>> &added,
+                        map<string, vector<string>> &removed) {
+        for (const auto &trace: after)
+                if (!before.count(trace.first))
+                        added.insert(trace);
+        for (const auto &trace: before)
+                if (!after.count(trace.first))
+                        removed.insert(trace);
+}
+
+TraceDiff TraceSolver::update(const set<string> &changed_fns, const set<string> &root_fns) {
+        TraceReport before = report();
+
+        // (1) recompute every node that read a changed summary.
+        for (const auto &fn: changed_fns) {
+                const auto &contexts = node_ids.find(fn);
+                if (contexts == node_ids.end())
+                        continue;
+                for (const auto &context: contexts->second)
+                        invalidate(context.second);
+        }
+        for (const auto &fn: changed_fns) {
+                const auto &merged = merged_ids.find(fn);
+                if (merged != merged_ids.end())
+                        invalidate(merged->second);
+        }
+
+        // (2) the roots' contexts depend on their own summaries.
+        roots.clear();
+        for (const auto &fn: root_fns)
+                add_root(fn);
+
+        // (3) recompute the invalidated nodes and any contexts they reach.
+        solve();
+
+        TraceReport after = report();
+        TraceDiff diff;
+        diff_traces(before.bugs, after.bugs, diff.added_bugs, diff.removed_bugs);
+        diff_traces(before.inconsistent_stores, after.inconsistent_stores,
+                    diff.added_inconsistent_stores, diff.removed_inconsistent_stores);
+        return diff;
+}
+
+vector<vector<string>> TraceSolver::bug_traces() const {
+        vector<vector<string>> traces;
+        for (int node: order) {
+                if (nodes[node].has_bad_store)
+                        traces.push_back(witness(node));
+        }
+        return traces;
+}
+
+vector<vector<string>> TraceSolver::inconsistent_traces() const {
+        vector<vector<string>> traces;
+        unordered_map<string, const TypeInfo *> variable_name_to_type;
+        for (int node: order) {
+                bool inconsistent = false;
+                for (const auto &fact: nodes[node].facts) {
+                        const auto &previously_found_type = variable_name_to_type.find(fact.first);
+                        if (previously_found_type == variable_name_to_type.end())
+                                variable_name_to_type[fact.first] = &fact.second;
+                        else if (*previously_found_type->second != fact.second)
+                                inconsistent = true;
+                }
+                if (inconsistent)
+                        traces.push_back(witness(node));
+        }
+        return traces;
+}
+
+TraceReport TraceSolver::report() const {
+        TraceReport result;
+        for (const auto &trace: bug_traces()) {
+                stringstream ss;
+                print_trace(ss, trace);
+                result.bugs.emplace(ss.str(), trace);
+        }
+        for (const auto &trace: inconsistent_traces()) {
+                stringstream ss;
+                print_trace(ss, trace);
+                result.inconsistent_stores.emplace(ss.str(), trace);
+        }
+        return result;
+}
+
+size_t TraceSolver::num_nodes() const {
+        return order.size();
+}
+
+size_t TraceSolver::num_merged_calls() const {
+        return merged_calls;
+}
+
+size_t TraceSolver::num_merged_functions() const {
+        return merged_ids.size();
+}
+
+int TraceSolver::get_node(const string &fn, const vector<TypeInfo> &argtypes, int depth) {
+        auto &contexts = node_ids[fn];
+        const auto &it = contexts.find(argtypes);
+        if (it != contexts.end())
+                return it->second;
+
+        bool too_deep = limits.max_depth >= 0 && depth >= limits.max_depth;
+        bool over_budget = limits.budget >= 0 && contexts.size() >= (size_t) max(limits.budget, 1);
+        if (!too_deep && !over_budget)
+                return add_node(fn, argtypes, depth, false);
+
+        // analyze the call in fn's joined context.
+        merged_calls++;
+        const auto &merged = merged_ids.find(fn);
+        if (merged == merged_ids.end()) {
+                int id = add_node(fn, argtypes, depth, true);
+                merged_ids[fn] = id;
+                return id;
+        }
+
+        int id = merged->second;
+        vector<TypeInfo> joined = join_argtypes(nodes[id].argtypes, argtypes);
+        if (!TypeInfoEqual()(joined, nodes[id].argtypes)) {
+                // the joined context grew, so its results must be recomputed.
+                nodes[id].argtypes = joined;
+                invalidate(id);
+        }
+        return id;
+}
+
+int TraceSolver::add_node(const string &fn, const vector<TypeInfo> &argtypes, int depth, bool merged) {
+        int id = nodes.size();
+        nodes.push_back({fn, argtypes, -1, false, {}, {}, true, depth, merged, true});
+        // the joined context is only reached through merged_ids, so that
+        // node_ids holds the regular contexts the budget counts.
+        if (!merged)
+                node_ids[fn][argtypes] = id;
+        worklist.push_back(id);
+        return id;
+}
+
+void TraceSolver::invalidate(int node) {
+        if (!nodes[node].queued) {
+                nodes[node].queued = true;
+                worklist.push_back(node);
+        }
+}
+
+void TraceSolver::process(int node) {
+        // copy what we need: get_node() may reallocate nodes.
+        const string fn = nodes[node].fn;
+        const vector<TypeInfo> argtypes = nodes[node].argtypes;
+        nodes[node].queued = false;
+        nodes[node].has_bad_store = false;
+        nodes[node].facts.clear();
+        nodes[node].callees.clear();
+
+        for (const FunctionSummary *fs: get_fn_summaries(fn, name_to_tu, fn_summaries)) {
+                for (const auto &store: fs->store_to_typeinfo) {
+                        for (const auto &source: store.second.source) {
+                                TypeInfo variable_type = store.second;
+                                if (source.kind == SOURCE_PARAM) {
+                                        if (source.param_no < 0 || (size_t) source.param_no >= argtypes.size())
+                                                continue;
+                                        variable_type = argtypes[source.param_no];
+
+                                        const TypeInfo *prior = prior_types.find(store.first);
+                                        if (prior && *prior != variable_type)
+                                                nodes[node].has_bad_store = true;
+                                }
+                                nodes[node].facts.push_back({store.first, variable_type});
+                        }
+                }
+
+                for (const auto &ccs: fs->calling_context) {
+                        for (const auto &call: ccs.second) {
+                                int callee = get_node(ccs.first, bind_arguments(call, argtypes), nodes[node].depth + 1);
+                                nodes[node].callees.push_back(callee);
+                        }
+                }
+        }
+}
+
+void TraceSolver::relink() {
+        // find the live nodes in breadth-first order, so that every node's
+        // parent lies on a shortest path from a root.
+        vector<bool> reached(nodes.size(), false);
+        order.clear();
+        for (int root: roots) {
+                if (!reached[root]) {
+                        reached[root] = true;
+                        nodes[root].parent = -1;
+                        order.push_back(root);
+                }
+        }
+        for (size_t i = 0; i < order.size(); i++) {
+                for (int callee: nodes[order[i]].callees) {
+                        if (!reached[callee]) {
+                                reached[callee] = true;
+                                nodes[callee].parent = order[i];
+                                order.push_back(callee);
+                        }
+                }
+        }
+
+        // forget the nodes that no root reaches anymore.
+        for (size_t i = 0; i < nodes.size(); i++) {
+                if (reached[i] || !nodes[i].live)
+                        continue;
+                TraceNode &node = nodes[i];
+                if (node.merged)
+                        merged_ids.erase(node.fn);
+                else
+                        node_ids[node.fn].erase(node.argtypes);
+                node.live = false;
+                node.argtypes.clear();
+                node.facts.clear();
+                node.callees.clear();
+        }
+}
+
+vector<string> TraceSolver::witness(int node) const {
+        vector<string> trace;
+        for (int i = node; i != -1; i = nodes[i].parent)
+                trace.push_back(nodes[i].fn);
+        reverse(trace.begin(), trace.end());
+        return trace;
+}
+
 void print_trace(ostream &of, const vector<string> &trace) {
         string sep = "";
         for (const auto &fn: trace) {
@@ -189,59 +365,176 @@ void print_trace(ostream &of, const vector<string> &trace) {
  * @param name_to_tu A map relating function names to the translation unit containing their definitions.
  * @param fn_summaries A collection of function summaries. fn_summaries[0] is the summary of each function in TU 0, etc.
  * @param fns_with_intrinsic_variables The set of functions that contain variables with intrinsic semantic types.
- * @param prior_types A map relating variable names to their type information.
+ * @param prior_types An index relating variable names and patterns to their type information.
  * @param num_units The number of translation units.
+ * @param limits Bounds the number of calling contexts analyzed per function.
+ * @param diagnostics Receives each distinct bug and inconsistent store trace.
  * @return vector<vector<string>> A vector of traces, e.g. [["fn1", "fn2", "lastFn"], ...]
  */
 vector<vector<string>> get_unconstrained_traces(const unordered_map<string, set<unsigned>> &name_to_tu,
                                                 const vector<map<string, FunctionSummary>> &fn_summaries,
                                                 const set<string> &fns_with_intrinsic_variables,
-                                                const map<string, TypeInfo> &prior_types,
-                                                int num_units) {
+                                                const PathIndex &prior_types,
+                                                int num_units,
+                                                const ContextLimits &limits,
+                                                DiagnosticsSink &diagnostics) {
+        TraceSolver solver(name_to_tu, fn_summaries, prior_types, num_units, limits);
+        for (const auto &fn: fns_with_intrinsic_variables)
+                solver.add_root(fn);
+        solver.solve();
+        cout << "analyzed " << solver.num_nodes() << " calling contexts from "
+             << fns_with_intrinsic_variables.size() << " functions" << endl;
+        if (solver.num_merged_calls() > 0)
+                cout << "joined " << solver.num_merged_calls() << " calls into the contexts of "
+                     << solver.num_merged_functions() << " functions to stay within the context limits" << endl;
+
         vector<vector<string>> result;
-        int i = 1;
         set<string> found_traces;
-        for (const auto &fn: fns_with_intrinsic_variables) {
-                cout << i << " / " << fns_with_intrinsic_variables.size() << endl;
-                set<string> visited;
-                const vector<TypeInfo> args = get_initial_argtypes(
-                        fn, 
-                        name_to_tu, 
-                        fn_summaries, 
-                        num_units
-                );
-                vector<vector<string>> inconsistent_storage_traces;
-                vector<vector<string>> traces = get_storage_trace(
-                        fn,
-                        visited,
-                        inconsistent_storage_traces,
-                        name_to_tu, 
-                        fn_summaries, 
-                        fns_with_intrinsic_variables,
-                        args,
-                        prior_types
-                );
-                for (const auto &trace: traces) {
-                        stringstream ss;
-                        print_trace(ss, trace);
-                        string trace_str = ss.str();
-                        if (found_traces.find(trace_str) == found_traces.end()) {
-                                found_traces.insert(trace_str);
-                                cout << "BUG: " << trace_str << endl;
+        for (const auto &trace: solver.bug_traces()) {
+                stringstream ss;
+                print_trace(ss, trace);
+                string trace_str = ss.str();
+                if (found_traces.find(trace_str) == found_traces.end()) {
+                        found_traces.insert(trace_str);
+                        Diagnostic d;
+                        d.kind = DIAG_UNCONSTRAINED_STORE;
+                        d.trace = trace;
+                        d.message = "BUG: " + trace_str;
+                        diagnostics.report(d);
+                        result.push_back(trace);
+                }
+        }
+
+        set<string> inconsistent_traces;
+        for (const auto &trace: solver.inconsistent_traces()) {
+                stringstream ss;
+                print_trace(ss, trace);
+                auto trace_str = ss.str();
+                if (inconsistent_traces.find(trace_str) == inconsistent_traces.end()) {
+                        inconsistent_traces.insert(trace_str);
+                        Diagnostic d;
+                        d.kind = DIAG_INCONSISTENT_STORE;
+                        d.trace = trace;
+                        d.message = "Inconsistent store: " + trace_str;
+                        diagnostics.report(d);
+                }
+        }
+        return result;
+}
+
+// Reports each of traces as a finding of kind, prefixing its message with
+// prefix.
+static void report_traces(const map<string, vector<string>> &traces, DiagnosticKind kind, bool fixed,
+                          const string &prefix, DiagnosticsSink &diagnostics) {
+        for (const auto &trace: traces) {
+                Diagnostic d;
+                d.kind = kind;
+                d.fixed = fixed;
+                d.trace = trace.second;
+                d.message = prefix + trace.first;
+                diagnostics.report(d);
+        }
+}
+
+void report_trace_diff(const TraceDiff &diff, DiagnosticsSink &diagnostics) {
+        report_traces(diff.added_bugs, DIAG_UNCONSTRAINED_STORE, false, "BUG: ", diagnostics);
+        report_traces(diff.added_inconsistent_stores, DIAG_INCONSISTENT_STORE, false,
+                      "Inconsistent store: ", diagnostics);
+        report_traces(diff.removed_bugs, DIAG_UNCONSTRAINED_STORE, true, "FIXED BUG: ", diagnostics);
+        report_traces(diff.removed_inconsistent_stores, DIAG_INCONSISTENT_STORE, true,
+                      "FIXED inconsistent store: ", diagnostics);
+        cout << diff.added_bugs.size() + diff.added_inconsistent_stores.size() << " new and "
+             << diff.removed_bugs.size() + diff.removed_inconsistent_stores.size()
+             << " fixed findings" << endl;
+}
+
+/**
+ * @brief Explains the types stored to a single variable.
+ *
+ * Starts at the stores to var and walks backward over callers only while the
+ * stored value is a parameter, so the cost depends on the callers involved
+ * rather than on the whole program.
+ *
+ * @param var The fully scoped name of the variable, e.g. "AP_GPS::state::location".
+ * @param name_to_tu A mapping from function names to the TUs whose summaries of them are used.
+ * @param fn_summaries A collection of function summaries. fn_summaries[0] is the summary of each function in TU 0, etc.
+ * @param prior_types An index relating variable names and patterns to their type information.
+ * @return vector<StoreExplanation> One explanation for each way a type reaches a store to var.
+ */
+vector<StoreExplanation> explain_variable(const string &var,
+                                          const unordered_map<string, set<unsigned>> &name_to_tu,
+                                          const vector<map<string, FunctionSummary>> &fn_summaries,
+                                          const PathIndex &prior_types) {
+        vector<StoreExplanation> result;
+        const TypeInfo *prior = prior_types.find(var);
+        auto explain = [&](const vector<string> &trace, const TypeInfo &type, bool resolved) {
+                bool contradicts_prior = resolved && prior && *prior != type;
+                result.push_back({trace, type, resolved, contradicts_prior});
+        };
+
+        // (1) find the stores to var, and the callers of every function.
+        // maps a callee to its callers and their call sites.
+        unordered_map<string, vector<pair<string, const vector<vector<TypeInfo>> *>>> callers;
+        // (function, parameter number) pairs whose value is stored to var.
+        deque<pair<vector<string>, int>> worklist;
+        for (size_t tu = 0; tu < fn_summaries.size(); tu++) {
+                for (const auto &fn_and_summary: fn_summaries[tu]) {
+                        // skip the copies of functions whose summary from
+                        // another TU is used.
+                        const auto &defined = name_to_tu.find(fn_and_summary.first);
+                        if (defined == name_to_tu.end() || !defined->second.count(tu))
+                                continue;
+                        const FunctionSummary &fs = fn_and_summary.second;
+                        for (const auto &ccs: fs.calling_context)
+                                callers[ccs.first].push_back({fn_and_summary.first, &ccs.second});
+
+                        const auto &store = fs.store_to_typeinfo.find(var);
+                        if (store == fs.store_to_typeinfo.end())
+                                continue;
+                        for (const auto &source: store->second.source) {
+                                if (source.kind == SOURCE_PARAM)
+                                        worklist.push_back({{fn_and_summary.first}, source.param_no});
+                                else
+                                        explain({fn_and_summary.first}, store->second, true);
                         }
                 }
-                set<string> inconsistent_traces;
-                for (const auto &trace: inconsistent_storage_traces) {
-                        stringstream ss;
-                        print_trace(ss, trace);
-                        auto trace_str = ss.str();
-                        if (inconsistent_traces.find(trace_str) == inconsistent_traces.end()) {
-                                inconsistent_traces.insert(trace_str);
-                                cout << "Inconsistent store: " << trace_str << endl;
+        }
+
+        // (2) walk backward from parameters to the arguments of their callers.
+        set<pair<string, int>> visited;
+        while (!worklist.empty()) {
+                auto [trace, param_no] = worklist.front();
+                worklist.pop_front();
+                const string fn = trace.front();
+                if (!visited.insert({fn, param_no}).second)
+                        continue;
+
+                const auto &it = callers.find(fn);
+                if (it == callers.end()) {
+                        // nobody calls fn, so the parameter's type is unknown.
+                        TypeInfo unknown;
+                        unknown.source.push_back({SOURCE_PARAM, param_no, ""});
+                        explain(trace, unknown, false);
+                        continue;
+                }
+
+                for (const auto &[caller, calls]: it->second) {
+                        vector<string> caller_trace = {caller};
+                        caller_trace.insert(caller_trace.end(), trace.begin(), trace.end());
+                        for (const auto &call: *calls) {
+                                if (param_no < 0 || (size_t) param_no >= call.size())
+                                        continue;
+                                const TypeInfo &arg = call[param_no];
+                                const auto &param_source = find_if(arg.source.begin(), arg.source.end(),
+                                                                   [](const TypeSource &s) { return s.kind == SOURCE_PARAM; });
+                                if (param_source != arg.source.end())
+                                        worklist.push_back({caller_trace, param_source->param_no});
+                                else
+                                        explain(caller_trace, arg, true);
                         }
                 }
-                result.insert(result.end(), traces.begin(), traces.end());
-                i++;
         }
+
         return result;
 }
+
@@ -2,12 +2,195 @@
 
 #include "common.hpp"
 #include "deduce.hpp"
+#include "diagnostics.hpp"
+#include "path_index.hpp"
+#include <deque>
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <vector>
 
+// A function analyzed in one calling context.
+struct TraceNode {
+        // the function's name
+        string fn;
+
+        // the types of the arguments the function was called with
+        vector<TypeInfo> argtypes;
+
+        // the node that first reached this node, or -1 for a root
+        int parent;
+
+        // true if this node stores a parameter into a variable whose
+        // prior type does not match the parameter's type
+        bool has_bad_store;
+
+        // the (variable, type) facts generated by this node's stores
+        vector<pair<string, TypeInfo>> facts;
+
+        // the nodes reached from this node's call sites
+        vector<int> callees;
+
+        // false once no root reaches this node
+        bool live;
+
+        // the number of calls between a root and this node when it was created
+        int depth;
+
+        // true if this node joins the contexts that exceeded the limits
+        bool merged;
+
+        // true while this node waits in the worklist
+        bool queued;
+};
+
+// Bounds the number of calling contexts the solver distinguishes.
+// Calls beyond a limit are analyzed in a single context per function, which
+// is the join of the contexts it replaces. -1 means unlimited.
+struct ContextLimits {
+        // calls at least this deep from a root do not get their own context
+        int max_depth = -1;
+
+        // the maximum number of distinct contexts per function, not counting
+        // the joined one
+        int budget = -1;
+};
+
+// The findings of the trace phase, by pretty-printed trace.
+struct TraceReport {
+        map<string, vector<string>> bugs;
+        map<string, vector<string>> inconsistent_stores;
+};
+
+// The findings that changed after an update, by pretty-printed trace.
+struct TraceDiff {
+        map<string, vector<string>> added_bugs;
+        map<string, vector<string>> removed_bugs;
+        map<string, vector<string>> added_inconsistent_stores;
+        map<string, vector<string>> removed_inconsistent_stores;
+};
+
+/**
+ * Worklist solver for the storage trace problem.
+ *
+ * Each node is a (function, calling context) pair. Processing a node applies
+ * its summaries' stores under the context, which generates (variable, type)
+ * facts, and binds each call site to the context to reach the callees'
+ * nodes. Every node is processed once, so the cost is bounded by the number
+ * of distinct contexts rather than the number of call paths, and recursive
+ * calls reach a fixpoint instead of being cut off.
+ *
+ * A node only reads the summaries of its own function, so when summaries
+ * change, update() recomputes just the nodes of the changed functions and
+ * the contexts they newly reach.
+ */
+class TraceSolver {
+public:
+        TraceSolver(const unordered_map<string, set<unsigned>> &name_to_tu,
+                    const vector<map<string, FunctionSummary>> &fn_summaries,
+                    const PathIndex &prior_types,
+                    int num_units,
+                    const ContextLimits &limits = {});
+
+        // Adds a function with intrinsic variables as an entry point.
+        void add_root(const string &fn);
+
+        // Processes nodes until no new (function, context) pairs are found.
+        void solve();
+
+        // Recomputes the results after the summaries of changed_fns changed.
+        // root_fns is the new set of functions with intrinsic variables.
+        TraceDiff update(const set<string> &changed_fns, const set<string> &root_fns);
+
+        // Returns the traces ending in a function with a mistyped store.
+        vector<vector<string>> bug_traces() const;
+
+        // Returns the traces ending in a store whose type differs from the
+        // first type found for the same variable.
+        vector<vector<string>> inconsistent_traces() const;
+
+        TraceReport report() const;
+
+        // Returns the number of live (function, context) pairs.
+        size_t num_nodes() const;
+
+        // Returns the number of calls analyzed in a joined context instead
+        // of their own, i.e. how much precision the limits traded for time.
+        size_t num_merged_calls() const;
+
+        // Returns the number of functions that have a joined context.
+        size_t num_merged_functions() const;
+
+private:
+        const unordered_map<string, set<unsigned>> &name_to_tu;
+        const vector<map<string, FunctionSummary>> &fn_summaries;
+        const PathIndex &prior_types;
+        int num_units;
+        ContextLimits limits;
+
+        vector<TraceNode> nodes;
+        // maps functions to their regular contexts, by argument types
+        unordered_map<string, unordered_map<vector<TypeInfo>, int, TypeInfoHash, TypeInfoEqual>> node_ids;
+        deque<int> worklist;
+        vector<int> roots;
+
+        // maps functions to their joined context
+        unordered_map<string, int> merged_ids;
+        size_t merged_calls = 0;
+
+        // the live nodes in breadth-first order from the roots
+        vector<int> order;
+
+        // Returns the node for (fn, argtypes), creating it if it is new.
+        // If creating it would exceed the limits, joins argtypes into fn's
+        // joined context instead.
+        int get_node(const string &fn, const vector<TypeInfo> &argtypes, int depth);
+
+        // Creates a node and schedules it for processing.
+        int add_node(const string &fn, const vector<TypeInfo> &argtypes, int depth, bool merged);
+
+        // Clears the results of node and schedules it for processing again.
+        void invalidate(int node);
+
+        void process(int node);
+
+        // Recomputes parents and drops the nodes no root reaches.
+        void relink();
+
+        // Returns the path of calls through which a root reaches node.
+        vector<string> witness(int node) const;
+};
+
 vector<vector<string>> get_unconstrained_traces(const unordered_map<string, set<unsigned>> &name_to_tu,
                                                 const vector<map<string, FunctionSummary>> &fn_summaries,
                                                 const set<string> &fns_with_intrinsic_variables,
-                                                const map<string, TypeInfo> &prior_types,
-                                                int num_units);
+                                                const PathIndex &prior_types,
+                                                int num_units,
+                                                const ContextLimits &limits,
+                                                DiagnosticsSink &diagnostics);
+
+// Reports the findings diff added, and the ones it removed as fixed.
+void report_trace_diff(const TraceDiff &diff, DiagnosticsSink &diagnostics);
+
+// Explains how one type reaches a store to a variable.
+struct StoreExplanation {
+        // the functions the type flows through, ending with the one that stores it
+        vector<string> trace;
+
+        // the type that is stored
+        TypeInfo type;
+
+        // false if the type comes from a parameter of a function without callers
+        bool resolved;
+
+        // true if the type does not match the variable's prior type
+        bool contradicts_prior;
+};
+
+vector<StoreExplanation> explain_variable(const string &var,
+                                          const unordered_map<string, set<unsigned>> &name_to_tu,
+                                          const vector<map<string, FunctionSummary>> &fn_summaries,
+                                          const PathIndex &prior_types);
+
+void print_trace(ostream &of, const vector<string> &trace);
+
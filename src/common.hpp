@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <optional>
@@ -54,8 +55,12 @@ struct Dimension {
 
         // Stores the numerator of the scalar multiple of a unit.
         // e.g. 1 cm = 1/100 * 1m
-        int scalar_numerator;
-        int scalar_denominator;
+        int64_t scalar_numerator;
+        int64_t scalar_denominator;
+
+        // True if the scalar did not fit in 64 bits, so that it is not
+        // meaningful. Such dimensions are never interned.
+        bool overflowed = false;
 
         // Returns true if this dimension is the bottom dimension.
         bool bottom() const {
@@ -73,13 +78,9 @@ struct Dimension {
                 for (size_t i = 0; i < coefficients.size(); i++) {
                         d.coefficients[i] = coefficients[i] + other.coefficients[i];
                 }
-                d.scalar_denominator = scalar_numerator * other.scalar_numerator;
-                d.scalar_numerator = scalar_denominator * other.scalar_denominator;
-                int factor = gcd(d.scalar_numerator, d.scalar_denominator);
-                if (factor != 0) {
-                        d.scalar_denominator /= factor;
-                        d.scalar_numerator /= factor;
-                }
+                d.overflowed = overflowed || other.overflowed;
+                d.set_scalar(scalar_numerator, scalar_denominator,
+                             other.scalar_numerator, other.scalar_denominator);
                 return d;
         }
 
@@ -90,27 +91,56 @@ struct Dimension {
                 for (size_t i = 0; i < coefficients.size(); i++) {
                         d.coefficients[i] = coefficients[i] - other.coefficients[i];
                 }
-                d.scalar_numerator = scalar_numerator * other.scalar_denominator;
-                d.scalar_denominator = scalar_denominator * other.scalar_numerator;
-                int factor = gcd(d.scalar_numerator, d.scalar_denominator);
-                if (factor != 1) {
-                        d.scalar_denominator /= factor;
-                        d.scalar_numerator /= factor;
-                }
+                d.overflowed = overflowed || other.overflowed;
+                d.set_scalar(scalar_numerator, scalar_denominator,
+                             other.scalar_denominator, other.scalar_numerator);
                 return d;
         }
 
         bool operator==(const Dimension &d) const {
                 return d.coefficients == coefficients &&
                        d.scalar_denominator == scalar_denominator &&
-                       d.scalar_numerator == scalar_numerator;
+                       d.scalar_numerator == scalar_numerator &&
+                       d.overflowed == overflowed;
         }
 
         bool operator!=(const Dimension &d) const {
                 return !(d == *this);
         }
+
+        // Sets the scalar to (n1 / d1) * (n2 / d2) in lowest terms, or sets
+        // overflowed if that does not fit in 64 bits. Rounding it instead
+        // would make equal dimensions built in different orders unequal.
+        void set_scalar(int64_t n1, int64_t d1, int64_t n2, int64_t d2) {
+                int64_t factor = gcd(n1, d2);
+                if (factor > 1) {
+                        n1 /= factor;
+                        d2 /= factor;
+                }
+                factor = gcd(n2, d1);
+                if (factor > 1) {
+                        n2 /= factor;
+                        d1 /= factor;
+                }
+                if (__builtin_mul_overflow(n1, n2, &scalar_numerator) ||
+                    __builtin_mul_overflow(d1, d2, &scalar_denominator)) {
+                        overflowed = true;
+                        scalar_numerator = 1;
+                        scalar_denominator = 1;
+                        return;
+                }
+                factor = gcd(scalar_numerator, scalar_denominator);
+                if (factor > 1) {
+                        scalar_numerator /= factor;
+                        scalar_denominator /= factor;
+                }
+        }
 };
 
+// Identifies an interned Dimension; see intern_dimension in units.hpp.
+// Equal dimensions have equal IDs.
+typedef int DimensionId;
+
 struct TypeInfo {
         // stores possible frames the object can take on
         set<int> frames;
@@ -122,7 +152,7 @@ struct TypeInfo {
         vector<TypeSource> source;
 
         // The high-fidelity type representation.
-        optional<Dimension> dimension;
+        optional<DimensionId> dimension;
 
         bool operator==(const TypeInfo &other) const {
                 if (other.dimension && dimension) {
@@ -156,6 +186,23 @@ struct TypeInfoHash {
         }
 };
 
+// Compares calling contexts exactly, including dimensions.
+// TypeInfo::operator== is not transitive when only some types carry a
+// dimension, so it cannot be paired with TypeInfoHash in hashed containers.
+struct TypeInfoEqual {
+        bool operator()(const vector<TypeInfo> &a, const vector<TypeInfo> &b) const noexcept {
+                if (a.size() != b.size())
+                        return false;
+                for (size_t i = 0; i < a.size(); i++) {
+                        if (a[i].frames != b[i].frames ||
+                            a[i].units != b[i].units ||
+                            a[i].dimension != b[i].dimension)
+                                return false;
+                }
+                return true;
+        }
+};
+
 struct FunctionSummary {
         // functions this function calls
         set<string> callees;
@@ -172,4 +219,8 @@ struct FunctionSummary {
         // tracks interesting stores that occur
         // maps C++ type info to our internal type info
         map<string, TypeInfo> store_to_typeinfo;
+
+        // the USRs of the definitions summarized, or none if the function
+        // is not defined in this TU
+        set<string> usrs;
 };
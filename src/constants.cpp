@@ -0,0 +1,165 @@
+#include <cmath>
+
+#include "constants.hpp"
+
+// Returns a / b in lowest terms, or nothing if it overflows.
+static optional<Rational> make_rational(int64_t numerator, int64_t denominator) {
+        if (denominator == 0)
+                return {};
+        if (denominator < 0) {
+                if (numerator == INT64_MIN || denominator == INT64_MIN)
+                        return {};
+                numerator = -numerator;
+                denominator = -denominator;
+        }
+        int64_t factor = gcd(numerator, denominator);
+        if (factor > 1) {
+                numerator /= factor;
+                denominator /= factor;
+        }
+        return Rational{numerator, denominator};
+}
+
+static optional<Rational> add(const Rational &a, const Rational &b, bool subtract) {
+        int64_t l, r, numerator, denominator;
+        if (__builtin_mul_overflow(a.numerator, b.denominator, &l) ||
+            __builtin_mul_overflow(b.numerator, a.denominator, &r) ||
+            __builtin_mul_overflow(a.denominator, b.denominator, &denominator) ||
+            (subtract ? __builtin_sub_overflow(l, r, &numerator) : __builtin_add_overflow(l, r, &numerator)))
+                return {};
+        return make_rational(numerator, denominator);
+}
+
+static optional<Rational> multiply(const Rational &a, const Rational &b) {
+        int64_t numerator, denominator;
+        if (__builtin_mul_overflow(a.numerator, b.numerator, &numerator) ||
+            __builtin_mul_overflow(a.denominator, b.denominator, &denominator))
+                return {};
+        return make_rational(numerator, denominator);
+}
+
+// Returns value as an exact decimal fraction, if it is one.
+static optional<Rational> double_to_rational(double value) {
+        if (!isfinite(value) || fabs(value) >= 9e18)
+                return {};
+        int64_t denominator = 1;
+        for (int digits = 0; digits <= 9; digits++, denominator *= 10) {
+                double scaled = value * denominator;
+                if (fabs(scaled) >= 9e18)
+                        break;
+                double rounded = round(scaled);
+                // floats carry about 7 significant digits.
+                if (fabs(scaled - rounded) <= 1e-6 * max(1.0, fabs(scaled)))
+                        return make_rational(static_cast<int64_t>(rounded), denominator);
+        }
+        return {};
+}
+
+// Evaluates a literal with libclang.
+static optional<Rational> evaluate_literal(CXCursor c) {
+        optional<Rational> result;
+        CXEvalResult eval = clang_Cursor_Evaluate(c);
+        if (!eval)
+                return result;
+        switch (clang_EvalResult_getKind(eval)) {
+        case CXEval_Int:
+                if (!clang_EvalResult_isUnsignedInt(eval))
+                        result = make_rational(clang_EvalResult_getAsLongLong(eval), 1);
+                else if (clang_EvalResult_getAsUnsigned(eval) <= INT64_MAX)
+                        result = make_rational(clang_EvalResult_getAsUnsigned(eval), 1);
+                break;
+        case CXEval_Float:
+                result = double_to_rational(clang_EvalResult_getAsDouble(eval));
+                break;
+        default:
+                break;
+        }
+        clang_EvalResult_dispose(eval);
+        return result;
+}
+
+// Returns if t is an integral type, whose division truncates.
+static bool has_integral_type(CXType t) {
+        CXType canonical = clang_getCanonicalType(t);
+        return canonical.kind >= CXType_Bool && canonical.kind <= CXType_Int128;
+}
+
+optional<Rational> ConstantEvaluator::evaluate(CXCursor c) {
+        const auto &it = cache.find(c);
+        if (it != cache.end())
+                return it->second;
+        optional<Rational> result = compute(c);
+        cache.emplace(c, result);
+        return result;
+}
+
+optional<Rational> ConstantEvaluator::compute(CXCursor c) {
+        switch (clang_getCursorKind(c)) {
+        case CXCursor_IntegerLiteral:
+        case CXCursor_FloatingLiteral:
+                return evaluate_literal(c);
+        case CXCursor_ParenExpr:
+        case CXCursor_UnexposedExpr:
+        case CXCursor_CStyleCastExpr:
+        case CXCursor_CXXStaticCastExpr:
+        case CXCursor_CXXFunctionalCastExpr: {
+                // the operand is the last child; casts may also have a type ref.
+                vector<CXCursor> children = get_children(c);
+                if (children.empty())
+                        return {};
+                optional<Rational> value = evaluate(children.back());
+                // e.g. (int) 2.5
+                if (value && has_integral_type(clang_getCursorType(c)))
+                        value = make_rational(value->numerator / value->denominator, 1);
+                return value;
+        }
+        case CXCursor_UnaryOperator: {
+                vector<CXCursor> children = get_children(c);
+                if (children.size() != 1)
+                        return {};
+                string op = get_unary_operator(c);
+                optional<Rational> value = evaluate(children[0]);
+                if (!value || (op != "-" && op != "+"))
+                        return {};
+                if (op == "-")
+                        return make_rational(value->numerator, -value->denominator);
+                return value;
+        }
+        case CXCursor_BinaryOperator: {
+                vector<CXCursor> children = get_children(c);
+                if (children.size() != 2)
+                        return {};
+                string op = get_binary_operator(c);
+                if (op != "+" && op != "-" && op != "*" && op != "/")
+                        return {};
+                optional<Rational> lhs = evaluate(children[0]);
+                optional<Rational> rhs = lhs ? evaluate(children[1]) : nullopt;
+                if (!rhs)
+                        return {};
+                if (op == "+" || op == "-")
+                        return add(lhs.value(), rhs.value(), op == "-");
+                if (op == "*")
+                        return multiply(lhs.value(), rhs.value());
+                if (rhs->numerator == 0)
+                        return {};
+                // multiply normalizes the sign of the inverted denominator.
+                optional<Rational> quotient = multiply(lhs.value(), {rhs->denominator, rhs->numerator});
+                if (quotient && has_integral_type(clang_getCursorType(c)))
+                        quotient = make_rational(quotient->numerator / quotient->denominator, 1);
+                return quotient;
+        }
+        case CXCursor_DeclRefExpr: {
+                // a const or constexpr variable has the value of its initializer.
+                CXCursor decl = clang_getCursorReferenced(c);
+                if (clang_getCursorKind(decl) != CXCursor_VarDecl ||
+                    !clang_isConstQualifiedType(clang_getCursorType(decl)))
+                        return {};
+                vector<CXCursor> children = get_children(decl);
+                if (children.empty() || !clang_isExpression(clang_getCursorKind(children.back())))
+                        return {};
+                return evaluate(children.back());
+        }
+        default:
+                return {};
+        }
+}
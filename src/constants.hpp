@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+#include "util.hpp"
+
+extern "C" {
+#include <clang-c/Index.h>
+}
+
+using namespace std;
+
+// An exact numeric constant, numerator / denominator, with denominator > 0.
+struct Rational {
+        int64_t numerator;
+        int64_t denominator;
+};
+
+/**
+ * Folds constant expressions into rationals.
+ *
+ * Handles integer and floating literals, const and constexpr variables with
+ * constant initializers, unary +/-, and + - * / over constants. Floating
+ * values are kept exact when they are decimal fractions (100.0f, 1e7, 0.01),
+ * so they can scale dimensions. Results are cached per cursor, so each
+ * expression and each constant's initializer is evaluated once per
+ * translation unit, and every CXEvalResult is disposed.
+ *
+ * Cursors do not outlive their translation unit, so an evaluator must not
+ * be used across translation units.
+ */
+class ConstantEvaluator {
+      public:
+        // Returns the value of the expression at c, if it is a constant.
+        optional<Rational> evaluate(CXCursor c);
+
+      private:
+        optional<Rational> compute(CXCursor c);
+
+        unordered_map<CXCursor, optional<Rational>, CursorHash, CursorEqual> cache;
+};
@@ -1,7 +1,8 @@
-#include <cassert>
-#include <sstream>
-#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
 #include "deduce.hpp"
+#include "util.hpp"
 using namespace std;
 
 // useful for debugging.
@@ -15,35 +16,220 @@ ostream& operator<<(ostream &out, const VariableEntry &ve) {
         return out;
 }
 
-// reads a stream containing a JSON array of VariableEntry's.
-vector<VariableEntry> read_variable_info(istream &in) {
-        vector<VariableEntry> result;
-
-        stringstream ss;
-        string line;
-        while (getline(in, line))
-                ss << line;
-
-        rapidjson::Document d;
-        d.Parse(ss.str().c_str());
-
-        auto array = d.GetArray();
-        for (auto i = array.Begin(); i != array.End(); i++) {
-                VariableEntry entry;
-                entry.variable_name = (*i)["VariableName"].GetString();
-                
-                auto coord_frames = (*i)["SemanticInfo"]["CoordinateFrames"].GetArray();
-                for (auto j = coord_frames.Begin(); j != coord_frames.End(); j++) {
-                        entry.semantic_info.coordinate_frames.insert(j->GetString());
+/**
+ * Receives the SAX events of a JSON array of VariableEntry's, e.g.
+ *   [{"VariableName": "AP_GPS::state::location::alt",
+ *     "SemanticInfo": {"CoordinateFrames": [...], "Units": ["centimeter"]}}]
+ * and emits each entry once its object ends. Unknown keys are skipped along
+ * with their values. Any other event stops the parse with a message.
+ */
+class VariableEntryHandler
+    : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, VariableEntryHandler> {
+      public:
+        explicit VariableEntryHandler(const function<void(VariableEntry &&)> &emit) : emit(emit) {}
+
+        // why the parse was stopped, if the handler stopped it
+        string error;
+
+        bool StartArray() {
+                switch (state) {
+                case TOP:
+                        state = ENTRIES;
+                        return true;
+                case FRAMES_START:
+                        state = FRAMES;
+                        return true;
+                case UNITS_START:
+                        state = UNITS;
+                        return true;
+                case SKIP:
+                        skip_depth++;
+                        return true;
+                default:
+                        return unexpected("array");
+                }
+        }
+
+        bool EndArray(rapidjson::SizeType) {
+                switch (state) {
+                case ENTRIES:
+                        state = DONE;
+                        return true;
+                case FRAMES:
+                case UNITS:
+                        state = SEMANTIC_INFO;
+                        return true;
+                case SKIP:
+                        return end_skipped();
+                default:
+                        return unexpected("end of array");
                 }
+        }
 
-                auto units = (*i)["SemanticInfo"]["Units"].GetArray();
-                for (auto j = units.Begin(); j != units.End(); j++) {
-                        entry.semantic_info.units.insert(j->GetString());
+        bool StartObject() {
+                switch (state) {
+                case ENTRIES:
+                        entry = VariableEntry();
+                        has_name = false;
+                        state = ENTRY;
+                        return true;
+                case SEMANTIC_INFO_START:
+                        state = SEMANTIC_INFO;
+                        return true;
+                case SKIP:
+                        skip_depth++;
+                        return true;
+                default:
+                        return unexpected("object");
                 }
+        }
 
-                result.push_back(entry);
+        bool EndObject(rapidjson::SizeType) {
+                switch (state) {
+                case ENTRY:
+                        if (!has_name) {
+                                error = "entry without a VariableName";
+                                return false;
+                        }
+                        emit(move(entry));
+                        state = ENTRIES;
+                        return true;
+                case SEMANTIC_INFO:
+                        state = ENTRY;
+                        return true;
+                case SKIP:
+                        return end_skipped();
+                default:
+                        return unexpected("end of object");
+                }
         }
 
-        return result;
+        bool Key(const char *str, rapidjson::SizeType length, bool) {
+                string_view key(str, length);
+                switch (state) {
+                case ENTRY:
+                        if (key == "VariableName") {
+                                state = VARIABLE_NAME;
+                        } else if (key == "SemanticInfo") {
+                                state = SEMANTIC_INFO_START;
+                        } else {
+                                skip(ENTRY);
+                        }
+                        return true;
+                case SEMANTIC_INFO:
+                        if (key == "CoordinateFrames") {
+                                state = FRAMES_START;
+                        } else if (key == "Units") {
+                                state = UNITS_START;
+                        } else {
+                                skip(SEMANTIC_INFO);
+                        }
+                        return true;
+                case SKIP:
+                        return true;
+                default:
+                        return unexpected("key");
+                }
+        }
+
+        bool String(const char *str, rapidjson::SizeType length, bool) {
+                switch (state) {
+                case VARIABLE_NAME:
+                        entry.variable_name.assign(str, length);
+                        has_name = true;
+                        state = ENTRY;
+                        return true;
+                case FRAMES:
+                        entry.semantic_info.coordinate_frames.emplace(str, length);
+                        return true;
+                case UNITS:
+                        entry.semantic_info.units.emplace(str, length);
+                        return true;
+                default:
+                        return Default();
+                }
+        }
+
+        // Handles the remaining scalars: null, booleans and numbers.
+        bool Default() {
+                if (state != SKIP)
+                        return unexpected("value");
+                if (skip_depth == 0)
+                        state = skip_return;
+                return true;
+        }
+
+        // Returns if the input held a complete array.
+        bool done() const { return state == DONE; }
+
+      private:
+        enum State {
+                TOP,
+                ENTRIES,
+                ENTRY,
+                VARIABLE_NAME,
+                SEMANTIC_INFO_START,
+                SEMANTIC_INFO,
+                FRAMES_START,
+                FRAMES,
+                UNITS_START,
+                UNITS,
+                SKIP,
+                DONE
+        };
+
+        // Skips the value of an unknown key, then returns to state after.
+        void skip(State after) {
+                state = SKIP;
+                skip_return = after;
+                skip_depth = 0;
+        }
+
+        bool end_skipped() {
+                if (--skip_depth == 0)
+                        state = skip_return;
+                return true;
+        }
+
+        bool unexpected(const char *what) {
+                error = string("unexpected ") + what;
+                return false;
+        }
+
+        const function<void(VariableEntry &&)> &emit;
+        VariableEntry entry;
+        bool has_name = false;
+        State state = TOP;
+        State skip_return = TOP;
+        int skip_depth = 0;
+};
+
+string read_variable_info(const string &path,
+                          const function<void(VariableEntry &&)> &emit) {
+        MappedFile file(path);
+        if (!file.ok())
+                return file.error();
+
+        VariableEntryHandler handler(emit);
+        rapidjson::MemoryStream stream(file.data(), file.size());
+        rapidjson::Reader reader;
+        rapidjson::ParseResult parsed =
+            reader.Parse<rapidjson::kParseValidateEncodingFlag>(stream, handler);
+        if (!parsed && handler.error.empty())
+                handler.error = rapidjson::GetParseError_En(parsed.Code());
+        else if (parsed && !handler.done())
+                handler.error = "expected an array of variables";
+        if (handler.error.empty())
+                return "";
+
+        // report the position as line:column.
+        size_t offset = parsed ? file.size() : min(parsed.Offset(), file.size());
+        size_t line = 1, line_start = 0;
+        for (size_t i = 0; i < offset; i++) {
+                if (file.data()[i] == '\n') {
+                        line++;
+                        line_start = i + 1;
+                }
+        }
+        return handler.error + " at " + to_string(line) + ":" + to_string(offset - line_start + 1);
 }
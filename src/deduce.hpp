@@ -1,7 +1,9 @@
 #pragma once
 
+#include <functional>
 #include <iostream>
 #include <set>
+#include <string>
 #include <vector>
 
 using namespace std;
@@ -16,4 +18,8 @@ struct VariableEntry {
         VariableSemanticInfo semantic_info;
 };
 
-vector<VariableEntry> read_variable_info(istream &in);
+// Streams the JSON array of VariableEntry's in the file at path to emit, one
+// entry at a time, without loading the whole document. Returns an empty
+// string on success, or else why the file could not be read.
+string read_variable_info(const string &path,
+                          const function<void(VariableEntry &&)> &emit);
@@ -0,0 +1,164 @@
+#include <iostream>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "diagnostics.hpp"
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> JSONWriter;
+
+// the names of the kinds in JSONL and SARIF, by DiagnosticKind
+static const char *const KIND_NAMES[] = {
+    "incorrect-store",
+    "unconstrained-frame",
+    "unconstrained-store",
+    "inconsistent-store",
+    "unit-conflict",
+};
+
+static void write_string(JSONWriter &w, const char *key, const string &value) {
+        w.Key(key);
+        w.String(value.c_str(), value.size());
+}
+
+// Writes the fields of d other than its kind, message and location.
+static void write_details(JSONWriter &w, const Diagnostic &d) {
+        if (!d.variable.empty())
+                write_string(w, "variable", d.variable);
+        if (!d.expected.empty())
+                write_string(w, "expected", d.expected);
+        if (!d.actual.empty())
+                write_string(w, "actual", d.actual);
+        if (!d.trace.empty()) {
+                w.Key("trace");
+                w.StartArray();
+                for (const auto &fn : d.trace)
+                        w.String(fn.c_str(), fn.size());
+                w.EndArray();
+        }
+}
+
+static string to_jsonl(const Diagnostic &d) {
+        rapidjson::StringBuffer buffer;
+        JSONWriter w(buffer);
+        w.StartObject();
+        write_string(w, "kind", KIND_NAMES[d.kind]);
+        if (!d.file.empty()) {
+                write_string(w, "file", d.file);
+                w.Key("line");
+                w.Uint(d.line);
+        }
+        write_details(w, d);
+        if (d.fixed) {
+                w.Key("fixed");
+                w.Bool(true);
+        }
+        write_string(w, "message", d.message);
+        w.EndObject();
+        return string(buffer.GetString(), buffer.GetSize());
+}
+
+static string to_sarif_result(const Diagnostic &d) {
+        rapidjson::StringBuffer buffer;
+        JSONWriter w(buffer);
+        w.StartObject();
+        write_string(w, "ruleId", KIND_NAMES[d.kind]);
+        write_string(w, "level", "warning");
+        if (d.fixed)
+                write_string(w, "baselineState", "absent");
+        w.Key("message");
+        w.StartObject();
+        write_string(w, "text", d.message);
+        w.EndObject();
+        if (!d.file.empty()) {
+                w.Key("locations");
+                w.StartArray();
+                w.StartObject();
+                w.Key("physicalLocation");
+                w.StartObject();
+                w.Key("artifactLocation");
+                w.StartObject();
+                write_string(w, "uri", d.file);
+                w.EndObject();
+                if (d.line) {
+                        w.Key("region");
+                        w.StartObject();
+                        w.Key("startLine");
+                        w.Uint(d.line);
+                        w.EndObject();
+                }
+                w.EndObject();
+                w.EndObject();
+                w.EndArray();
+        }
+        w.Key("properties");
+        w.StartObject();
+        write_details(w, d);
+        w.EndObject();
+        w.EndObject();
+        return string(buffer.GetString(), buffer.GetSize());
+}
+
+static const char SARIF_HEADER[] =
+    "{\"version\":\"2.1.0\","
+    "\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\","
+    "\"runs\":[{\"tool\":{\"driver\":{\"name\":\"sa4u\"}},\"results\":[";
+
+static const char SARIF_FOOTER[] = "]}]}";
+
+DiagnosticsSink::DiagnosticsSink(DiagnosticsFormat format, const string &path, mutex &cout_lock)
+    : format(format) {
+        if (path.empty())
+                writer = make_unique<AsyncLineWriter>(cout, false, &cout_lock);
+        else
+                writer = make_unique<AsyncLineWriter>(path, false);
+        if (format == DIAGNOSTICS_SARIF)
+                writer->submit({SARIF_HEADER});
+}
+
+void DiagnosticsSink::report(const Diagnostic &d) {
+        string line;
+        switch (format) {
+        case DIAGNOSTICS_JSONL:
+                line = to_jsonl(d);
+                break;
+        case DIAGNOSTICS_SARIF:
+                line = to_sarif_result(d);
+                break;
+        case DIAGNOSTICS_TEXT:
+        default:
+                line = d.message;
+                break;
+        }
+
+        lock_guard<mutex> guard(lock);
+        if (!reported.insert(line).second)
+                return;
+        // SARIF results are the elements of one array.
+        if (format == DIAGNOSTICS_SARIF && !first)
+                line = "," + line;
+        first = false;
+        writer->submit({move(line)});
+}
+
+void DiagnosticsSink::close() {
+        lock_guard<mutex> guard(lock);
+        if (closed)
+                return;
+        closed = true;
+        if (format == DIAGNOSTICS_SARIF)
+                writer->submit({SARIF_FOOTER});
+        writer->close();
+}
+
+bool DiagnosticsSink::parse_format(const string &name, DiagnosticsFormat &format) {
+        if (name == "text")
+                format = DIAGNOSTICS_TEXT;
+        else if (name == "jsonl")
+                format = DIAGNOSTICS_JSONL;
+        else if (name == "sarif")
+                format = DIAGNOSTICS_SARIF;
+        else
+                return false;
+        return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "writer.hpp"
+
+using namespace std;
+
+enum DiagnosticKind {
+        // a store of a value with a unit other than the variable's
+        DIAG_INCORRECT_STORE,
+        // a function using a MAVLink frame it never checks
+        DIAG_UNCONSTRAINED_FRAME,
+        // a trace that stores a value of unknown unit to a typed variable
+        DIAG_UNCONSTRAINED_STORE,
+        // a trace that stores values of different units to one variable
+        DIAG_INCONSISTENT_STORE,
+        // variables that unit inference found to need different dimensions
+        DIAG_UNIT_CONFLICT,
+};
+
+// A finding of the analysis. Fields that do not apply are left empty.
+struct Diagnostic {
+        DiagnosticKind kind;
+
+        // where the finding is, if it has a location
+        string file;
+        unsigned line = 0;
+
+        // the variable stored to, e.g. AP_GPS::state::location
+        string variable;
+
+        // the expected and the actual unit
+        string expected;
+        string actual;
+
+        // the functions involved, outermost caller first
+        vector<string> trace;
+
+        // the finding as one line of text
+        string message;
+
+        // if the finding was reported by the baseline run and is now gone
+        bool fixed = false;
+};
+
+enum DiagnosticsFormat { DIAGNOSTICS_TEXT, DIAGNOSTICS_JSONL, DIAGNOSTICS_SARIF };
+
+/**
+ * Streams diagnostics as they are found, from a writer thread.
+ *
+ * The text format is one message per line, as sa4u has always printed
+ * them. JSONL is one object per line. SARIF is a single SARIF 2.1.0 log,
+ * written incrementally with one result per line, and only complete once
+ * the sink is closed.
+ */
+class DiagnosticsSink {
+      public:
+        // Writes to path, or to cout if path is empty, holding cout_lock
+        // while writing to it.
+        DiagnosticsSink(DiagnosticsFormat format, const string &path, mutex &cout_lock);
+        ~DiagnosticsSink() { close(); }
+
+        // Returns if the output could be opened.
+        bool ok() const { return writer->ok(); }
+
+        // Writes d, unless an identical diagnostic was written before, e.g.
+        // by another TU that includes the same function. Thread-safe.
+        void report(const Diagnostic &d);
+
+        // Finishes the output. Nothing may be reported afterwards.
+        void close();
+
+        // Parses the name of a format, e.g. "jsonl". Returns if it is known.
+        static bool parse_format(const string &name, DiagnosticsFormat &format);
+
+      private:
+        DiagnosticsFormat format;
+        unique_ptr<AsyncLineWriter> writer;
+
+        mutex lock;
+        // the lines written so far
+        unordered_set<string> reported;
+        bool first = true;
+        bool closed = false;
+};
@@ -0,0 +1,142 @@
+#include <queue>
+
+#include "hierarchy.hpp"
+#include "util.hpp"
+
+// Returns the name of the class type t.
+static string get_class_name(CXType t) {
+        return get_type_spelling(clang_getCanonicalType(t));
+}
+
+void ClassHierarchy::add_translation_unit(CXTranslationUnit unit) {
+        clang_visitChildren(
+            clang_getTranslationUnitCursor(unit),
+            [](CXCursor c, CXCursor, CXClientData cd) {
+                    ClassHierarchy *hierarchy = static_cast<ClassHierarchy *>(cd);
+                    CXCursorKind kind = clang_getCursorKind(c);
+                    if (kind == CXCursor_ClassDecl || kind == CXCursor_StructDecl)
+                            hierarchy->add_class(c);
+                    else if (kind == CXCursor_CXXMethod && clang_CXXMethod_isVirtual(c))
+                            hierarchy->add_method(c);
+                    // classes are declared in namespaces and other classes;
+                    // function bodies are skipped.
+                    switch (kind) {
+                    case CXCursor_Namespace:
+                    case CXCursor_LinkageSpec:
+                    case CXCursor_UnexposedDecl:
+                    case CXCursor_ClassDecl:
+                    case CXCursor_StructDecl:
+                    case CXCursor_ClassTemplate:
+                            return CXChildVisit_Recurse;
+                    default:
+                            return CXChildVisit_Continue;
+                    }
+            },
+            this);
+}
+
+void ClassHierarchy::add_class(CXCursor c) {
+        string name = get_class_name(clang_getCursorType(c));
+        set<string> class_bases;
+        clang_visitChildren(
+            c,
+            [](CXCursor child, CXCursor, CXClientData cd) {
+                    if (clang_getCursorKind(child) == CXCursor_CXXBaseSpecifier)
+                            static_cast<set<string> *>(cd)->insert(
+                                get_class_name(clang_getCursorType(child)));
+                    return CXChildVisit_Continue;
+            },
+            &class_bases);
+        if (class_bases.empty())
+                return;
+
+        resolved_targets[0].clear();
+        resolved_targets[1].clear();
+        bases[name].insert(class_bases.begin(), class_bases.end());
+}
+
+void ClassHierarchy::add_method(CXCursor c) {
+        CXCursor *overridden = nullptr;
+        unsigned num_overridden = 0;
+        clang_getOverriddenCursors(c, &overridden, &num_overridden);
+        if (num_overridden == 0)
+                return;
+
+        string method_name = get_cursor_spelling(c);
+        string method = get_class_name(clang_getCursorType(clang_getCursorSemanticParent(c))) +
+                        "::" + method_name;
+        vector<string> base_methods;
+        for (unsigned i = 0; i < num_overridden; i++) {
+                CXCursor defining_class = clang_getCursorSemanticParent(overridden[i]);
+                base_methods.push_back(get_class_name(clang_getCursorType(defining_class)) +
+                                       "::" + method_name);
+        }
+        clang_disposeOverriddenCursors(overridden);
+
+        resolved_targets[0].clear();
+        resolved_targets[1].clear();
+        for (const string &base_method : base_methods)
+                add_override(method, base_method);
+}
+
+void ClassHierarchy::add_override(const string &method, const string &base_method) {
+        if (!overrides[method].insert(base_method).second)
+                return;
+
+        // method and everything overriding it become targets of base_method
+        // and of everything base_method overrides.
+        set<string> targets = overridden_by[method];
+        targets.insert(method);
+        set<string> seen = {base_method};
+        queue<string> worklist;
+        worklist.push(base_method);
+        while (!worklist.empty()) {
+                string m = worklist.front();
+                worklist.pop();
+                overridden_by[m].insert(targets.begin(), targets.end());
+                const auto &it = overrides.find(m);
+                if (it == overrides.end())
+                        continue;
+                for (const string &up : it->second)
+                        if (seen.insert(up).second)
+                                worklist.push(up);
+        }
+}
+
+const vector<string> &ClassHierarchy::possible_targets(const string &fq_method, bool is_dynamic) {
+        const auto &cached = resolved_targets[is_dynamic].find(fq_method);
+        if (cached != resolved_targets[is_dynamic].end())
+                return cached->second;
+
+        vector<string> &result = resolved_targets[is_dynamic][fq_method];
+        result.push_back(fq_method);
+        size_t scope = fq_method.rfind("::");
+        if (scope == string::npos)
+                return result;
+        string class_name = fq_method.substr(0, scope);
+        string suffix = fq_method.substr(scope);
+
+        if (is_dynamic) {
+                const auto &it = overridden_by.find(fq_method);
+                if (it != overridden_by.end())
+                        result.insert(result.end(), it->second.begin(), it->second.end());
+        }
+
+        // methods inherited from the bases, nearest first.
+        set<string> seen = {class_name};
+        queue<string> worklist;
+        worklist.push(class_name);
+        while (!worklist.empty()) {
+                const auto &it = bases.find(worklist.front());
+                worklist.pop();
+                if (it == bases.end())
+                        continue;
+                for (const string &base : it->second) {
+                        if (!seen.insert(base).second)
+                                continue;
+                        result.push_back(base + suffix);
+                        worklist.push(base);
+                }
+        }
+        return result;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <clang-c/Index.h>
+}
+
+using namespace std;
+
+/**
+ * Records the base classes of every class and the methods overriding every
+ * virtual method of one translation unit.
+ *
+ * Classes and methods are named as in get_fq_methods. The hierarchy is built
+ * by add_translation_unit before the TU's functions are summarized, so the
+ * targets of a call depend only on the TU, as cached and stored summaries
+ * assume; an override declared only in other TUs is not a target. Each
+ * worker thread builds its own, so no lock is needed.
+ */
+class ClassHierarchy {
+      public:
+        // Records the classes and virtual methods declared in unit, outside
+        // of function bodies.
+        void add_translation_unit(CXTranslationUnit unit);
+
+        // Records the direct bases of the class declared at c.
+        void add_class(CXCursor c);
+
+        // Records the methods that the method declared at c overrides.
+        void add_method(CXCursor c);
+
+        /**
+         * Returns the methods that a call to fq_method may execute: fq_method
+         * itself, the methods overriding it if the call is dynamic, and then
+         * the methods of the same name that fq_method's class inherits. The
+         * result is computed once per method, and valid until the hierarchy
+         * changes.
+         */
+        const vector<string> &possible_targets(const string &fq_method, bool is_dynamic);
+
+      private:
+        // Records that method overrides base_method.
+        void add_override(const string &method, const string &base_method);
+
+        // maps a class to its direct bases
+        unordered_map<string, set<string>> bases;
+
+        // maps a method to the methods it directly overrides
+        unordered_map<string, set<string>> overrides;
+
+        // maps a method to every method that transitively overrides it
+        unordered_map<string, set<string>> overridden_by;
+
+        // the results of possible_targets, for static and dynamic calls
+        unordered_map<string, vector<string>> resolved_targets[2];
+};
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <deque>
+#include <numeric>
+#include <optional>
+#include "infer.hpp"
+#include "units.hpp"
+
+using namespace std;
+
+Term UnitConstraints::variable(const string &name) {
+        const auto &it = name_to_term.find(name);
+        if (it != name_to_term.end())
+                return it->second;
+        Term t = num_terms++;
+        name_to_term[name] = t;
+        return t;
+}
+
+Term UnitConstraints::fresh() {
+        return num_terms++;
+}
+
+void UnitConstraints::known(Term t, const Dimension &d) {
+        knowns.push_back({t, d});
+}
+
+void UnitConstraints::equal(Term a, Term b) {
+        if (a != b)
+                equalities.push_back({a, b});
+}
+
+void UnitConstraints::product(Term result, Term lhs, Term rhs) {
+        products.push_back({result, lhs, rhs});
+}
+
+// result = lhs / rhs is the same as lhs = result * rhs.
+void UnitConstraints::quotient(Term result, Term lhs, Term rhs) {
+        products.push_back({lhs, result, rhs});
+}
+
+void UnitConstraints::merge(const UnitConstraints &other) {
+        // renumber the other's terms after ours, except for named terms
+        // that we already have.
+        vector<Term> renumbered(other.num_terms, -1);
+        for (const auto &p : other.name_to_term)
+                renumbered[p.second] = variable(p.first);
+        for (auto &t : renumbered) {
+                if (t == -1)
+                        t = fresh();
+        }
+
+        for (const auto &p : other.knowns)
+                knowns.push_back({renumbered[p.first], p.second});
+        for (const auto &p : other.equalities)
+                equalities.push_back({renumbered[p.first], renumbered[p.second]});
+        for (const auto &p : other.products)
+                products.push_back({renumbered[p[0]], renumbered[p[1]], renumbered[p[2]]});
+}
+
+// Disjoint sets of terms with path compression and union by rank.
+class UnionFind {
+public:
+        explicit UnionFind(int size) : parent(size), rank(size, 0) {
+                iota(parent.begin(), parent.end(), 0);
+        }
+
+        int find(int t) {
+                while (parent[t] != t) {
+                        parent[t] = parent[parent[t]];
+                        t = parent[t];
+                }
+                return t;
+        }
+
+        void unite(int a, int b) {
+                a = find(a);
+                b = find(b);
+                if (a == b)
+                        return;
+                if (rank[a] < rank[b])
+                        swap(a, b);
+                parent[b] = a;
+                if (rank[a] == rank[b])
+                        rank[a]++;
+        }
+
+private:
+        vector<int> parent;
+        vector<int> rank;
+};
+
+InferenceResult UnitConstraints::solve() const {
+        // (1) merge equal terms.
+        UnionFind classes(num_terms);
+        for (const auto &p : equalities)
+                classes.unite(p.first, p.second);
+
+        // (2) assign known dimensions and propagate them through products.
+        // Every class is assigned at most once, and each product is revisited
+        // only when one of its three classes is assigned.
+        vector<optional<Dimension>> value(num_terms);
+        map<int, vector<Dimension>> conflicting;
+        deque<int> assigned;
+        auto assign = [&](int cls, const Dimension &d) {
+                // a product whose scalar overflowed stays unknown.
+                if (d.overflowed)
+                        return;
+                if (!value[cls]) {
+                        value[cls] = d;
+                        assigned.push_back(cls);
+                } else if (value[cls].value() != d) {
+                        conflicting[cls].push_back(d);
+                }
+        };
+
+        vector<vector<size_t>> products_of(num_terms);
+        for (size_t i = 0; i < products.size(); i++) {
+                for (Term t : products[i])
+                        products_of[classes.find(t)].push_back(i);
+        }
+
+        for (const auto &p : knowns)
+                assign(classes.find(p.first), p.second);
+
+        while (!assigned.empty()) {
+                int cls = assigned.front();
+                assigned.pop_front();
+                for (size_t i : products_of[cls]) {
+                        int result = classes.find(products[i][0]);
+                        int lhs = classes.find(products[i][1]);
+                        int rhs = classes.find(products[i][2]);
+                        const auto &r = value[result], &l = value[lhs], &s = value[rhs];
+                        if (l && s)
+                                assign(result, l.value() * s.value());
+                        else if (r && l && l->scalar_numerator != 0)
+                                assign(rhs, r.value() / l.value());
+                        else if (r && s && s->scalar_numerator != 0)
+                                assign(lhs, r.value() / s.value());
+                }
+        }
+
+        // (3) report the dimension of every named term.
+        InferenceResult result;
+        map<int, vector<string>> class_to_names;
+        for (const auto &p : name_to_term) {
+                int cls = classes.find(p.second);
+                if (value[cls])
+                        result.inferred[p.first] = value[cls].value();
+                if (conflicting.find(cls) != conflicting.end())
+                        class_to_names[cls].push_back(p.first);
+        }
+
+        for (const auto &p : conflicting) {
+                UnitConflict conflict;
+                conflict.variables = class_to_names[p.first];
+                conflict.dimensions.push_back(value[p.first].value());
+                for (const auto &d : p.second) {
+                        if (find(conflict.dimensions.begin(), conflict.dimensions.end(), d) == conflict.dimensions.end())
+                                conflict.dimensions.push_back(d);
+                }
+                result.conflicts.push_back(conflict);
+        }
+        return result;
+}
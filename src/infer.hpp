@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+using namespace std;
+
+// Identifies the unknown dimension of a variable or subexpression.
+typedef int Term;
+
+// Two or more dimensions that were inferred for the same variables.
+struct UnitConflict {
+        // the named terms that must share one dimension
+        vector<string> variables;
+
+        // the dimensions that were found for them
+        vector<Dimension> dimensions;
+};
+
+struct InferenceResult {
+        // maps variable names to their inferred dimension
+        map<string, Dimension> inferred;
+
+        vector<UnitConflict> conflicts;
+};
+
+/**
+ * Collects constraints between the dimensions of terms.
+ *
+ * Constraints are generated while walking the AST: a store makes both sides
+ * equal, a call binds each argument to the callee's parameter, and * and /
+ * relate the dimension of the result to the dimensions of the operands.
+ * Each worker thread owns its own instance; the instances are merged before
+ * solving.
+ */
+class UnitConstraints {
+public:
+        // Returns the term of a named variable, creating it if needed.
+        Term variable(const string &name);
+
+        // Returns a new term for an anonymous subexpression.
+        Term fresh();
+
+        // Requires t to have the dimension d.
+        void known(Term t, const Dimension &d);
+
+        // Requires a and b to have the same dimension.
+        void equal(Term a, Term b);
+
+        // Requires result = lhs * rhs.
+        void product(Term result, Term lhs, Term rhs);
+
+        // Requires result = lhs / rhs.
+        void quotient(Term result, Term lhs, Term rhs);
+
+        // Adds the constraints of other. Variables with the same name are
+        // the same term.
+        void merge(const UnitConstraints &other);
+
+        // Solves the constraints with union-find over the equalities and
+        // propagation of exponent vectors over the products.
+        InferenceResult solve() const;
+
+private:
+        int num_terms = 0;
+        unordered_map<string, Term> name_to_term;
+        vector<pair<Term, Dimension>> knowns;
+        vector<pair<Term, Term>> equalities;
+
+        // {result, lhs, rhs} for result = lhs * rhs
+        vector<array<Term, 3>> products;
+};
@@ -17,9 +17,20 @@ string lmcp_field_to_set_function_name(const string &structure_name, const strin
         return "afrl::cmasi::"+structure_name+"::set"+result;
 }
 
-// returns a map relating lmcp message functions to their unit kinds
+// returns the type of the accessors of a field with the given unit
+TypeInfo lmcp_accessor_type(const string &unit_name, int unit_id) {
+        return {
+                // TODO: frame is incorrect, but fine for now.
+                .frames = {MAV_FRAME_GLOBAL},
+                .units = {unit_id},
+                .source = {},
+                .dimension = string_to_dimension_id(unit_name),
+        };
+}
+
+// returns a map relating lmcp message functions to their unit kinds.
+// units not in unitname_to_id are added to it with IDs from nextid on.
 map<string, TypeInfo> get_units_of_functions(const pugi::xml_document &doc, map<string, int> &unitname_to_id, int &nextid) {
-        nextid = 0;
         map<string, TypeInfo> functions_to_units;
         for (const pugi::xml_node &structure: doc.child("MDM").child("StructList")) {
                 string structure_name = structure.attribute("Name").value();
@@ -30,20 +41,9 @@ map<string, TypeInfo> get_units_of_functions(const pugi::xml_document &doc, map<
                                         unitname_to_id[unit_type] = nextid++;
                                 }
                                 string field_name = field.attribute("Name").value();
-                                functions_to_units[lmcp_field_to_get_function_name(structure_name, field_name)] = {
-                                        // TODO: frame is incorrect, but fine for now.
-                                        .frames = {MAV_FRAME_GLOBAL},
-                                        .units = {unitname_to_id[unit_type]},
-                                        .source = {},
-                                        .dimension = string_to_dimension(unit_type),
-                                };
-                                functions_to_units[lmcp_field_to_set_function_name(structure_name, field_name)] = {
-                                        // TODO: frame is incorrect, but fine for now.
-                                        .frames = {MAV_FRAME_GLOBAL},
-                                        .units = {unitname_to_id[unit_type]},
-                                        .source = {},
-                                        .dimension = string_to_dimension(unit_type),
-                                };
+                                TypeInfo type = lmcp_accessor_type(unit_type, unitname_to_id[unit_type]);
+                                functions_to_units[lmcp_field_to_get_function_name(structure_name, field_name)] = type;
+                                functions_to_units[lmcp_field_to_set_function_name(structure_name, field_name)] = type;
                         }
                 }
         }
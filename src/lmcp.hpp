@@ -13,6 +13,8 @@ using namespace std;
 string lmcp_field_to_get_function_name(const string &structure_name, const string &field_name);
 string lmcp_field_to_set_function_name(const string &structure_name, const string &field_name);
 
+TypeInfo lmcp_accessor_type(const string &unit_name, int unit_id);
+
 map<string, TypeInfo> get_units_of_functions(const pugi::xml_document &doc,
                                              map<string, int> &unitname_to_id, 
                                              int &num_units);
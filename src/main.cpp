@@ -1,13 +1,19 @@
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
 #include <set>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -32,16 +38,35 @@ extern "C" {
 
 #include "cfg.hpp"
 #include "common.hpp"
+#include "constants.hpp"
 #include "deduce.hpp"
+#include "diagnostics.hpp"
+#include "hierarchy.hpp"
+#include "infer.hpp"
 #include "lmcp.hpp"
 #include "mav.hpp"
 #include "methods.hpp"
+#include "path.hpp"
+#include "path_index.hpp"
+#include "perfect_hash.hpp"
+#include "prescan.hpp"
+#include "spec.hpp"
+#include "summary_cache.hpp"
+#include "summary_store.hpp"
 #include "util.hpp"
 #include "units.hpp"
+#include "writer.hpp"
 
 #define UNUSED /* UNUSED */
 
-enum MessageDefinitionType { UNKNOWN, MAVLINK, LMCP };
+// The type of an expression, computed once per function.
+struct ExprType {
+        // the type information, if any part of the expression has one
+        optional<TypeInfo> type;
+
+        // the unit inference term, or -1 without --infer-units
+        Term term;
+};
 
 struct ASTContext {
         // maps each mavlink struct name to its frame field
@@ -73,6 +98,10 @@ struct ASTContext {
         // stores the current function usr
         string current_usr;
 
+        // stores the qualified name of the current function, which names
+        // its parameters, return value and locals for unit inference
+        string current_qualified_fn;
+
         // stores the names of the parameters of the current function
         set<string> &current_fn_params;
 
@@ -95,14 +124,12 @@ struct ASTContext {
         // stores the translation unit number
         unsigned translation_unit_no;
 
-        // stores the name of the current function's semantic context
+        // stores the path of the current function's semantic context
         // e.g. if we're in a struct T, then stores "T"
-        string semantic_context;
+        PathBuilder semantic_context;
 
-        // Stores the set of writes that we're interested in.
-        // A write is interesting if it is a write to a variable with a type
-        // known a priori.
-        const set<string> &writes_to_variables_with_known_types;
+        // the probe of semantic_context in prior_types
+        PathIndex::Probe semantic_context_probe;
 
         // tracks the current interesting stores
         map<string, TypeInfo> &store_to_typeinfo;
@@ -113,6 +140,14 @@ struct ASTContext {
         // tracks cursors that we've already seen
         unordered_set<string> &seen_definitions;
 
+        // the definitions whose summaries the analysis uses, if
+        // seen_definitions only tracks this TU's, or else nullptr
+        unordered_set<string> *claimed_definitions;
+
+        // false if the analysis uses another TU's summary of the current
+        // function, which this TU only summarizes for its own store
+        bool owns_definition;
+
         // used to coordinate access to shared data structures
         mutex &lock;
 
@@ -120,13 +155,42 @@ struct ASTContext {
         int thread_no;
 
         // Relates variables with known types to their types.
-        const map<string, TypeInfo> &prior_var_to_typeinfo;
+        // A write is interesting if it is a write to one of these variables.
+        const PathIndex &prior_types;
 
         // Tracks the return types of functions.
-        map<string, TypeInfo> &function_names_to_return_unit;
+        const PerfectHashTable<TypeInfo> &function_names_to_return_unit;
 
         // Relates unit IDs to their human-readable names.
         const map<int, string> &id_to_unitname;
+
+        // Relates unit IDs to their dimensions, if they have one.
+        const vector<optional<DimensionId>> &unit_dimensions;
+
+        // Collects unit constraints for --infer-units, or nullptr.
+        UnitConstraints *unit_constraints;
+
+        // The classes and overrides of the translation unit, for resolving
+        // virtual calls.
+        ClassHierarchy &hierarchy;
+
+        // Folds the constant expressions of the translation unit.
+        ConstantEvaluator &constants;
+
+        // Caches the types of the current function's expressions.
+        unordered_map<CXCursor, ExprType, CursorHash, CursorEqual> &expr_types;
+
+        // Collects the names of stored-to variables for --dump-variables,
+        // or nullptr.
+        AsyncLineWriter::Buffer *variable_dump;
+
+        // Receives the findings, or nullptr if they are only kept in
+        // tu_diagnostics, to be compared with the stored ones.
+        DiagnosticsSink *diagnostics;
+
+        // Keeps the findings of parsing this translation unit, to be stored
+        // with its summaries.
+        vector<Diagnostic> &tu_diagnostics;
 };
 
 string trim(const string &str, const string &whitespace = " ") {
@@ -140,9 +204,6 @@ string trim(const string &str, const string &whitespace = " ") {
         return str.substr(strBegin, strRange);
 }
 
-enum CXChildVisitResult type_check_rhs(CXCursor c, CXCursor UNUSED, CXClientData cd);
-static thread_local int ctaw_childno = 0;
-
 /**
  * Returns true if the cursor contains a decl ref expr referring to a local
  * variable.
@@ -192,45 +253,6 @@ string get_full_path(CXString compile_dir, CXString filename) {
                 return string(dir_cstr) + string("/") + string(filename_cstr);
 }
 
-enum CXChildVisitResult count_left_tokens(CXCursor c, CXCursor UNUSED,
-                                          CXClientData cd) {
-        unsigned *count = static_cast<unsigned *>(cd);
-        CXTranslationUnit unit = clang_Cursor_getTranslationUnit(c);
-        CXSourceRange range = clang_getCursorExtent(c);
-        CXToken *tokens;
-        clang_tokenize(unit, range, &tokens, count);
-        clang_disposeTokens(unit, tokens, *count);
-        return CXChildVisit_Break;
-}
-
-// Returns the binary operator at cursor.
-// How this is accomplished:
-//   A binary operator has two children.
-//   We count the number of tokens of the left child,
-//   so then the next token must be the operator.
-string get_binary_operator(CXCursor cursor) {
-        unsigned left_tokens;
-        clang_visitChildren(cursor, count_left_tokens, &left_tokens);
-
-        CXTranslationUnit unit = clang_Cursor_getTranslationUnit(cursor);
-        CXSourceRange range = clang_getCursorExtent(cursor);
-        CXToken *tokens;
-        unsigned count;
-        clang_tokenize(unit, range, &tokens, &count);
-
-        string result;
-        if (left_tokens < count) {
-                CXString token_spelling =
-                    clang_getTokenSpelling(unit, tokens[left_tokens]);
-                result = string(clang_getCString(token_spelling));
-                clang_disposeString(token_spelling);
-        }
-
-        clang_disposeTokens(unit, tokens, count);
-
-        return result;
-}
-
 // Returns the underlying typename associated with type.
 // e.g. if there are qualifiers like const, those are removed.
 string get_object_typename(CXType type) {
@@ -284,24 +306,6 @@ optional<string> get_struct_object(CXCursor c) {
         return p.second;
 }
 
-// helps with get_first_decl
-enum CXChildVisitResult get_first_decl_helper(CXCursor cursor, CXCursor UNUSED,
-                                              CXClientData client_data) {
-        optional<string> *op = static_cast<optional<string> *>(client_data);
-        if (clang_getCursorKind(cursor) == CXCursor_DeclRefExpr) {
-                *op = get_cursor_spelling(cursor);
-                return CXChildVisit_Break;
-        }
-        return CXChildVisit_Recurse;
-}
-
-// returns the first decl ref expr used in c
-optional<string> get_first_decl(CXCursor c) {
-        optional<string> result;
-        clang_visitChildren(c, get_first_decl_helper, &result);
-        return result;
-}
-
 enum CXChildVisitResult check_mavlink(CXCursor cursor, CXCursor parent,
                                       CXClientData client_data) {
         ASTContext *ctx = static_cast<ASTContext *>(client_data);
@@ -328,31 +332,70 @@ enum CXChildVisitResult check_mavlink(CXCursor cursor, CXCursor parent,
         return CXChildVisit_Recurse;
 }
 
-enum CXChildVisitResult pretty_print_memberRefExpr_walker(CXCursor c,
-                                                          CXCursor UNUSED,
-                                                          CXClientData cd) {
-        string *sptr = static_cast<string *>(cd);
-        CXCursorKind kind = clang_getCursorKind(c);
-        CXString cursor_spelling = clang_getCursorSpelling(c);
-        string cursor_str = clang_getCString(cursor_spelling);
-        clang_disposeString(cursor_spelling);
-        if (kind == CXCursor_DeclRefExpr) {
-                *sptr = cursor_str + *sptr;
-        } else if (kind == CXCursor_MemberRefExpr) {
-                *sptr = "::" + cursor_str + *sptr;
-        }
-        return CXChildVisit_Recurse;
+// Stores the file and line of cursor.
+static void get_location(CXCursor cursor, string &file, unsigned &line) {
+        CXFile cx_file;
+        clang_getSpellingLocation(clang_getCursorLocation(cursor), &cx_file, &line, nullptr, nullptr);
+        CXString filename = clang_getFileName(cx_file);
+        const char *str = clang_getCString(filename);
+        file = str ? str : "";
+        clang_disposeString(filename);
+}
+
+// Reports a finding of parsing the current translation unit.
+static void report_parse_diagnostic(ASTContext *ctx, const Diagnostic &d) {
+        if (ctx->diagnostics)
+                ctx->diagnostics->report(d);
+        ctx->tu_diagnostics.push_back(d);
+}
+
+// Interns the spelling of c and appends it to path.
+static void append_spelling(PathBuilder &path, CXCursor c) {
+        CXString spelling = clang_getCursorSpelling(c);
+        path.push_back(clang_getCString(spelling));
+        clang_disposeString(spelling);
+}
+
+/**
+ * Appends the scope resolution operations of cursor to path, i.e. the member
+ * and decl refs it accesses through, outermost first. Returns if they start
+ * at a decl ref rather than at an implicit this.
+ * Pre: cursor is a member ref expression.
+ */
+bool append_scope_resolution_operations(PathBuilder &path, CXCursor cursor) {
+        size_t start = path.size();
+        pair<PathBuilder *, bool> data(&path, false);
+        clang_visitChildren(
+            cursor,
+            [](CXCursor c, CXCursor UNUSED, CXClientData cd) {
+                    auto *data = static_cast<pair<PathBuilder *, bool> *>(cd);
+                    CXCursorKind kind = clang_getCursorKind(c);
+                    if (kind == CXCursor_DeclRefExpr) {
+                            append_spelling(*data->first, c);
+                            data->second = true;
+                            return CXChildVisit_Break;
+                    } else if (kind == CXCursor_MemberRefExpr) {
+                            append_spelling(*data->first, c);
+                    }
+                    return CXChildVisit_Recurse;
+            },
+            &data);
+        // the walk visits the innermost access first
+        path.reverse(start);
+        return data.second;
 }
 
 // returns a pretty-printed member ref expr
 string pretty_print_memberRefExpr(CXCursor c) {
-        string result;
-        CXString cursor_spelling = clang_getCursorSpelling(c);
-        string cursor_str = clang_getCString(cursor_spelling);
-        clang_disposeString(cursor_spelling);
-        clang_visitChildren(c, pretty_print_memberRefExpr_walker, &result);
-        result += "::" + cursor_str;
-        return result;
+        PathBuilder scope;
+        bool from_decl = append_scope_resolution_operations(scope, c);
+        PathBuilder path;
+        // accesses through this are printed as ::member
+        if (!from_decl)
+                path.push_back("");
+        path.append(scope);
+        append_spelling(path, c);
+        return path.str();
 }
 
 enum CXChildVisitResult pretty_print_store_walker(CXCursor c, CXCursor UNUSED,
@@ -377,47 +420,6 @@ string pretty_print_store(CXCursor c) {
         return result;
 }
 
-// if c is part of a variable initialization, returns a cursor representing the
-// declaration
-CXCursor get_initialization_decl(CXCursor c) {
-        CXCursor parent = c;
-        while (!clang_Cursor_isNull(parent) &&
-               clang_getCursorKind(parent) != CXCursor_VarDecl) {
-                parent = clang_getCursorSemanticParent(parent);
-        }
-        return parent;
-}
-
-/**
- * Returns a string representing the scope resolution operations.
- * Pre: cursor is a member ref expression.
- */
-string get_scope_resolution_operations(CXCursor cursor) {
-        string result = "";
-        clang_visitChildren(
-            cursor,
-            [](CXCursor c, CXCursor UNUSED, CXClientData cd) {
-                    string *str = static_cast<string *>(cd);
-                    CXCursorKind kind = clang_getCursorKind(c);
-                    if (kind == CXCursor_DeclRefExpr) {
-                            if (str->empty())
-                                    *str = get_cursor_spelling(c);
-                            else
-                                    *str = get_cursor_spelling(c) + "::" + *str;
-                            return CXChildVisit_Break;
-                    } else if (kind == CXCursor_MemberRefExpr) {
-                            string spelling = get_cursor_spelling(c);
-                            if (str->empty())
-                                    *str = spelling;
-                            else
-                                    *str = spelling + "::" + *str;
-                    }
-                    return CXChildVisit_Recurse;
-            },
-            &result);
-        return result;
-}
-
 /**
  * Returns if cursor accesses a global variable.
  */
@@ -442,25 +444,29 @@ bool is_global_access(CXCursor cursor) {
         return result;
 }
 
+// Appends the current semantic context to path. Outside of methods the
+// context is a single empty component, so accesses are named ::field.
+static void append_semantic_context(PathBuilder &path, ASTContext *ctx) {
+        if (ctx->semantic_context.empty())
+                path.push_back("");
+        else
+                path.append(ctx->semantic_context);
+}
+
 /**
- * Gets the smallest part of the current semantic context.
+ * Returns the Scope::Field path of an object access.
+ * Pre: cursor is a member ref expression.
  */
-string get_smallest_context(const string &semantic_context) {
-        if (semantic_context.length() < 3)
-                return semantic_context;
-
-        int second_to_last_index = -1, last_index = -1;
-        for (size_t i = 0; i < semantic_context.length() - 1; i++) {
-                if (semantic_context[i] == ':' &&
-                    semantic_context[i + 1] == ':') {
-                        second_to_last_index = last_index;
-                        last_index = i;
-                }
-        }
-
-        if (second_to_last_index != -1)
-                return semantic_context.substr(second_to_last_index + 2);
-        return semantic_context;
+PathBuilder get_member_access_path(ASTContext *ctx, CXCursor cursor) {
+        PathBuilder scope_ops;
+        append_scope_resolution_operations(scope_ops, cursor);
+
+        PathBuilder path;
+        if (scope_ops.empty() || !is_global_access(cursor))
+                append_semantic_context(path, ctx);
+        path.append(scope_ops);
+        append_spelling(path, cursor);
+        return path;
 }
 
 /**
@@ -468,29 +474,47 @@ string get_smallest_context(const string &semantic_context) {
  * Pre: cursor is a member ref expression.
  */
 string get_member_access_str(ASTContext *ctx, CXCursor cursor) {
-        string access_str;
-        string scope_ops = get_scope_resolution_operations(cursor);
-        string sctx = get_smallest_context(ctx->semantic_context);
-
-        if (scope_ops.empty())
-                access_str =
-                    ctx->semantic_context + "::" + get_cursor_spelling(cursor);
-        else if (is_global_access(cursor))
-                access_str = scope_ops + "::" + get_cursor_spelling(cursor);
-        else
-                access_str = ctx->semantic_context + "::" + scope_ops +
-                             "::" + get_cursor_spelling(cursor);
-        return access_str;
+        return get_member_access_path(ctx, cursor).str();
+}
+
+// Steps probe by the spelling of c without copying it.
+static PathIndex::Probe step_spelling(const PathIndex &index, const PathIndex::Probe &probe, CXCursor c) {
+        CXString spelling = clang_getCursorSpelling(c);
+        PathIndex::Probe next = index.step(probe, clang_getCString(spelling));
+        clang_disposeString(spelling);
+        return next;
+}
+
+/**
+ * Returns the prior type of the access that get_member_access_str names, or
+ * nullptr. The access is probed by component IDs, so its name is never
+ * materialized.
+ * Pre: cursor is a member ref expression.
+ */
+const TypeInfo *find_member_access_prior(ASTContext *ctx, CXCursor cursor) {
+        PathBuilder scope_ops;
+        append_scope_resolution_operations(scope_ops, cursor);
+
+        const PathIndex &index = ctx->prior_types;
+        PathIndex::Probe probe = ctx->semantic_context_probe;
+        if (!scope_ops.empty() && is_global_access(cursor))
+                probe = index.root();
+        probe = index.step_path(probe, scope_ops);
+        if (probe.rejected())
+                return nullptr;
+        return index.value(step_spelling(index, probe, cursor));
 }
 
 /**
  * t - a known type
  * name - variable name
  * type_to_field_to_unit - relates types to fields to units
+ * unit_dimensions - relates units to dimensions
  * tinfo - type info
  */
 void add_inner_vars(const string &t, const string &name,
                     const map<string, map<string, int>> &type_to_field_to_unit,
+                    const vector<optional<DimensionId>> &unit_dimensions,
                     const TypeSource &source, map<string, TypeInfo> &tinfo) {
         auto typeinfo = type_to_field_to_unit.find(t);
         if (typeinfo == type_to_field_to_unit.end())
@@ -498,6 +522,8 @@ void add_inner_vars(const string &t, const string &name,
         for (const auto &pair : typeinfo->second) {
                 string varname = name + "::" + pair.first;
                 tinfo[varname].units.insert(pair.second);
+                if ((size_t) pair.second < unit_dimensions.size())
+                        tinfo[varname].dimension = unit_dimensions[pair.second];
 
                 for (int i = MAV_FRAME_GLOBAL; i < MAV_FRAME_NONE; i++)
                         tinfo[varname].frames.insert(i);
@@ -518,98 +544,229 @@ void add_unknown_param(const string &name, ASTContext *ctx, TypeSource source) {
                 ctx->var_types.back()[name] = ti;
 }
 
-enum CXChildVisitResult check_tainted_decl_walker(CXCursor c, CXCursor UNUSED,
-                                                  CXClientData cd) {
-        ASTContext *ctx = static_cast<ASTContext *>(cd);
-        CXCursorKind kind = clang_getCursorKind(c);
+// Returns the name of the variable declared or referenced at c for unit
+// inference. Local variables are scoped by the qualified name of the
+// current function.
+string get_inference_name(ASTContext *ctx, CXCursor c) {
+        if (clang_getCursorKind(c) == CXCursor_MemberRefExpr)
+                return get_member_access_str(ctx, c);
+
+        CXCursor decl = clang_getCursorKind(c) == CXCursor_DeclRefExpr ? clang_getCursorReferenced(c) : c;
+        string name = get_cursor_spelling(c);
+        if (clang_getCursorLinkage(decl) == CXLinkage_NoLinkage)
+                return ctx->current_qualified_fn + "::" + name;
+        return name;
+}
+
+// Returns the name of the function called at c for unit inference: its
+// qualified name, as in the function's own definition, or its spelling for
+// a call through a pointer.
+static string get_inference_callee(CXCursor c) {
+        CXCursor callee = clang_getCursorReferenced(c);
+        if (clang_Cursor_isNull(callee))
+                return get_cursor_spelling(c);
+        return get_qualified_name(callee);
+}
+
+// Returns the type of the variable referenced at c, if it is known.
+optional<TypeInfo> type_variable(CXCursor c, ASTContext *ctx) {
+        if (clang_getCursorKind(c) == CXCursor_DeclRefExpr) {
+                string varname = get_cursor_spelling(c);
+                optional<TypeInfo> ti = get_var_typeinfo(varname, ctx->var_types);
+                if (ti)
+                        return ti;
+
+                if (ctx->current_fn_params.find(varname) != ctx->current_fn_params.end()) {
+                        TypeInfo param;
+                        // any frame.
+                        for (int i = MAV_FRAME_GLOBAL; i < MAV_FRAME_NONE; i++)
+                                param.frames.insert(i);
+                        for (int i = 0; i < ctx->num_units; i++)
+                                param.units.insert(i);
+                        param.source.push_back({SOURCE_PARAM, ctx->param_to_number[varname], ""});
+                        return param;
+                }
+
+                const TypeInfo *prior = ctx->prior_types.find(varname);
+                if (prior)
+                        return *prior;
+                return {};
+        }
 
-        // TODO: refactor this into an expression-level type checker.
-        string varname = "";
-        optional<TypeInfo> ti;
-        if (kind == CXCursor_DeclRefExpr) {
-                varname = get_cursor_spelling(c);
-        } else if (kind == CXCursor_MemberRefExpr) {
-                spdlog::trace("(thread {}) pretty printing", ctx->thread_no);
-                varname = pretty_print_memberRefExpr(c);
-                spdlog::trace("(thread {}) pretty printed", ctx->thread_no);
+        // c is a member ref expression.
+        optional<TypeInfo> ti = get_var_typeinfo(pretty_print_memberRefExpr(c), ctx->var_types);
+        if (ti)
+                return ti;
+
+        // See if the variable has a type that was supplied via the prior type switch.
+        string access = get_member_access_str(ctx, c);
+        ti = get_var_typeinfo(access, ctx->var_types);
+        if (ti)
+                return ti;
+        const TypeInfo *prior = find_member_access_prior(ctx, c);
+        if (prior)
+                return *prior;
+        return {};
+}
+
+// Returns the type of the first child of c that has one.
+optional<TypeInfo> type_first_child(CXCursor c, ASTContext *ctx);
+
+/**
+ * Returns the type of the expression at c.
+ *
+ * Each subexpression is typed once per function: results are cached by
+ * cursor, so walkers that look at overlapping expressions, and operands of
+ * nested operators like a * b * c, share the work. With --infer-units, the
+ * same pass generates the unit constraints of the expression.
+ */
+const ExprType &type_expression(CXCursor c, ASTContext *ctx) {
+        const auto &cached = ctx->expr_types.find(c);
+        if (cached != ctx->expr_types.end())
+                return cached->second;
+
+        UnitConstraints *constraints = ctx->unit_constraints;
+        ExprType result = {{}, -1};
+        CXCursorKind kind = clang_getCursorKind(c);
+        if (kind == CXCursor_DeclRefExpr || kind == CXCursor_MemberRefExpr) {
+                result.type = type_variable(c, ctx);
+                if (constraints) {
+                        result.term = constraints->variable(get_inference_name(ctx, c));
+                        if (result.type && result.type->dimension)
+                                constraints->known(result.term, get_dimension(result.type->dimension.value()));
+                }
+                // a constant scales what it multiplies, like a literal.
+                optional<Rational> value;
+                if (!result.type && kind == CXCursor_DeclRefExpr)
+                        value = ctx->constants.evaluate(c);
+                if (value)
+                        result.type = {
+                                .frames = {},
+                                .units = {},
+                                .source = {},
+                                .dimension = intern_dimension(numeric_factor_dimension(value->numerator, value->denominator)),
+                        };
+                // e.g. a field of a parameter takes the parameter's type.
+                if (!result.type)
+                        result.type = type_first_child(c, ctx);
         } else if (kind == CXCursor_CallExpr) {
-                string fq_method_name = get_fq_method(c);
-                ctx->lock.lock();
-                // See if we know the return type of the method.
-                if (ctx->function_names_to_return_unit.find(fq_method_name) == ctx->function_names_to_return_unit.end()) {
-                        ctx->lock.unlock();
-                        return CXChildVisit_Recurse;
+                string spelling = get_cursor_spelling(c);
+                vector<CXCursor> children = get_children(c);
+                if (spelling.empty() && children.size() == 1) {
+                        // an implicit constructor or conversion.
+                        result = type_expression(children[0], ctx);
+                } else {
+                        // See if we know the return type of any method the call may execute.
+                        bool is_dynamic = clang_Cursor_isDynamicCall(c);
+                        for (const string &fq_method_name : get_fq_methods(c)) {
+                                for (const string &target : ctx->hierarchy.possible_targets(fq_method_name, is_dynamic)) {
+                                        const TypeInfo *return_unit = ctx->function_names_to_return_unit.find(target);
+                                        if (return_unit) {
+                                                result.type = *return_unit;
+                                                break;
+                                        }
+                                }
+                                if (result.type)
+                                        break;
+                        }
+
+                        if (constraints) {
+                                result.term = constraints->variable(get_inference_callee(c) + "::#return");
+                                if (result.type && result.type->dimension)
+                                        constraints->known(result.term, get_dimension(result.type->dimension.value()));
+                        }
+                        if (!result.type)
+                                result.type = type_first_child(c, ctx);
                 }
-                ti = ctx->function_names_to_return_unit.at(fq_method_name);
-                ctx->lock.unlock();
         } else if (kind == CXCursor_BinaryOperator) {
-                string spelling = get_binary_operator(c);
-                if (spelling == "*") {
-                        int old_ctaw = ctaw_childno;
-                        ctaw_childno = 1;
-                        pair<optional<TypeInfo>, ASTContext *> lhs_p = {{}, ctx};
-                        clang_visitChildren(c, type_check_rhs, &lhs_p);
-
-                        pair<optional<TypeInfo>, ASTContext *> rhs_p = {{}, ctx};
-                        ctaw_childno = 0;
-                        clang_visitChildren(c, type_check_rhs, &rhs_p);
-                        ctaw_childno = old_ctaw;
-
-                        if (lhs_p.first && lhs_p.first.value().dimension &&
-                            rhs_p.first && rhs_p.first.value().dimension) {
-                                    TypeInfo lhs_ti = lhs_p.first.value();
-                                    TypeInfo rhs_ti = rhs_p.first.value();
-                                    
-                                    set<int> frames;
-                                    frames.insert(lhs_ti.frames.begin(), lhs_ti.frames.end());
-                                    frames.insert(rhs_ti.frames.begin(), rhs_ti.frames.end());
-
-                                    set<int> units;
-                                    units.insert(lhs_ti.units.begin(), lhs_ti.units.end());
-                                    units.insert(rhs_ti.units.begin(), rhs_ti.units.end());
-
-                                    ti = {
-                                            .frames = frames,
-                                            .units = units,
-                                            .source = {},
-                                            .dimension = lhs_ti.dimension.value() * rhs_ti.dimension.value(),
-                                    };
+                vector<CXCursor> children = get_children(c);
+                string op = children.size() == 2 ? get_binary_operator(c) : "";
+                if (op == "*" || op == "/") {
+                        const ExprType &lhs = type_expression(children[0], ctx);
+                        const ExprType &rhs = type_expression(children[1], ctx);
+                        if (lhs.type && lhs.type->dimension && rhs.type && rhs.type->dimension) {
+                                set<int> frames = lhs.type->frames;
+                                frames.insert(rhs.type->frames.begin(), rhs.type->frames.end());
+                                set<int> units = lhs.type->units;
+                                units.insert(rhs.type->units.begin(), rhs.type->units.end());
+                                DimensionId lhs_dimension = lhs.type->dimension.value();
+                                DimensionId rhs_dimension = rhs.type->dimension.value();
+                                result.type = {
+                                        .frames = frames,
+                                        .units = units,
+                                        .source = {},
+                                        .dimension = op == "*" ? multiply_dimensions(lhs_dimension, rhs_dimension)
+                                                               : divide_dimensions(lhs_dimension, rhs_dimension),
+                                };
+                        } else {
+                                result.type = lhs.type ? lhs.type : rhs.type;
                         }
+
+                        if (constraints) {
+                                // numeric constants are scale factors here; elsewhere
+                                // they take on the dimension of their context.
+                                Term operands[2] = {lhs.term, rhs.term};
+                                const ExprType *operand_types[2] = {&lhs, &rhs};
+                                for (int i = 0; i < 2; i++) {
+                                        const optional<TypeInfo> &t = operand_types[i]->type;
+                                        // a constant with a prior type is a variable.
+                                        if (t && !t->units.empty())
+                                                continue;
+                                        optional<Rational> value = ctx->constants.evaluate(children[i]);
+                                        if (value) {
+                                                operands[i] = constraints->fresh();
+                                                constraints->known(operands[i], numeric_factor_dimension(value->numerator, value->denominator));
+                                        }
+                                }
+                                result.term = constraints->fresh();
+                                if (op == "*")
+                                        constraints->product(result.term, operands[0], operands[1]);
+                                else
+                                        constraints->quotient(result.term, operands[0], operands[1]);
+                        }
+                } else if (op == "+" || op == "-" || op == "+=" || op == "-=" || op == "=") {
+                        const ExprType &lhs = type_expression(children[0], ctx);
+                        const ExprType &rhs = type_expression(children[1], ctx);
+                        result.type = lhs.type ? lhs.type : rhs.type;
+                        if (constraints) {
+                                constraints->equal(lhs.term, rhs.term);
+                                result.term = lhs.term;
+                        }
+                } else {
+                        result.type = type_first_child(c, ctx);
                 }
-        } else if (kind == CXCursor_IntegerLiteral) {
-                CXEvalResult result = clang_Cursor_Evaluate(c);
-                int value = clang_EvalResult_getAsInt(result);
-                Dimension d = {
-                        .coefficients = {0, 0, 0, 0, 0, 0, 0},
-                        .scalar_numerator = value,
-                        .scalar_denominator = 1,
-                };
-                ti = {
-                        .frames = {},
-                        .units = {},
-                        .source = {},
-                        .dimension = d,
-                };
+        } else if (kind == CXCursor_IntegerLiteral || kind == CXCursor_FloatingLiteral) {
+                optional<Rational> value = ctx->constants.evaluate(c);
+                if (value)
+                        result.type = {
+                                .frames = {},
+                                .units = {},
+                                .source = {},
+                                .dimension = intern_dimension(numeric_factor_dimension(value->numerator, value->denominator)),
+                        };
+        } else if (kind == CXCursor_ParenExpr || kind == CXCursor_UnexposedExpr ||
+                   kind == CXCursor_CStyleCastExpr || kind == CXCursor_CXXStaticCastExpr ||
+                   kind == CXCursor_CXXFunctionalCastExpr) {
+                // the operand is the last child; casts may also have a type ref.
+                vector<CXCursor> children = get_children(c);
+                if (!children.empty())
+                        result = type_expression(children.back(), ctx);
         } else {
-                return CXChildVisit_Recurse;
+                result.type = type_first_child(c, ctx);
         }
 
-        if (!varname.empty()) {
-                ti = get_var_typeinfo(varname, ctx->var_types);
-        }
+        if (constraints && result.term == -1)
+                result.term = constraints->fresh();
+        return ctx->expr_types.emplace(c, result).first->second;
+}
 
-        if (ti.has_value() && !ctx->var_types.empty()) {
-                spdlog::trace("(thread {}) getting initialization info",
-                              ctx->thread_no);
-                CXCursor lhs = get_initialization_decl(c);
-                spdlog::trace("(thread {}) got initialization info",
-                              ctx->thread_no);
-                string new_varname = get_cursor_spelling(lhs);
-                ctx->var_types.back()[new_varname] = ti.value();
-                return CXChildVisit_Break;
+optional<TypeInfo> type_first_child(CXCursor c, ASTContext *ctx) {
+        for (CXCursor child : get_children(c)) {
+                const ExprType &t = type_expression(child, ctx);
+                if (t.type)
+                        return t.type;
         }
-
-        return CXChildVisit_Recurse;
+        return {};
 }
 
 // Checks if cursor stores a mavlink message field into a variable declaration
@@ -621,168 +778,25 @@ void check_tainted_decl(CXCursor cursor, ASTContext *ctx) {
         if (is_known_type && !ctx->var_types.empty()) {
                 TypeSource source = {SOURCE_INTRINSIC, 0, ""};
                 add_inner_vars(cursor_typename, get_cursor_spelling(cursor),
-                               ctx->type_to_field_to_unit, source,
-                               ctx->var_types.back());
-        } else {
-                spdlog::trace("(thread {}) walking", ctx->thread_no);
-                clang_visitChildren(cursor, check_tainted_decl_walker, ctx);
-                spdlog::trace("(thread {}) walked", ctx->thread_no);
-        }
-}
-
-enum CXChildVisitResult check_tainted_assgn_walker(CXCursor c, CXCursor UNUSED,
-                                                   CXClientData cd) {
-        if (!ctaw_childno) {
-                ctaw_childno++;
-                return CXChildVisit_Continue;
-        }
-
-        pair<optional<TypeInfo>, ASTContext *> *p =
-            static_cast<pair<optional<TypeInfo>, ASTContext *> *>(cd);
-        CXCursorKind kind = clang_getCursorKind(c);
-        string varname;
-        if (kind == CXCursor_MemberRefExpr) {
-                varname = get_member_access_str(p->second, c);
-        } else if (kind == CXCursor_DeclRefExpr) {
-                varname = get_cursor_spelling(c);
-        } else if (kind == CXCursor_CallExpr) {
-                string fq_method_name = get_fq_method(c);
-                ASTContext *ctx = p->second;
-                ctx->lock.lock();
-                // See if we know the return type of the method.
-                if (ctx->function_names_to_return_unit.find(fq_method_name) == ctx->function_names_to_return_unit.end()) {
-                        ctx->lock.unlock();
-                        return CXChildVisit_Recurse;
-                }
-                p->first = ctx->function_names_to_return_unit.at(fq_method_name);
-                ctx->lock.unlock();
-        }
-
-        if (varname == "")
-                return CXChildVisit_Recurse;
-
-        p->first = get_var_typeinfo(varname, p->second->var_types);
-        const map<string, TypeInfo> &priors = p->second->prior_var_to_typeinfo;
-        // See if the variable has a type that was supplied via the prior type switch.
-        if (!p->first && priors.find(varname) != priors.end()) {
-                p->first = {priors.find(varname)->second};
-        }
-
-        if (p->first)
-                return CXChildVisit_Break;
-        else
-                return CXChildVisit_Recurse;
-
-        return CXChildVisit_Recurse;
-}
-
-enum CXChildVisitResult type_check_rhs(CXCursor c, CXCursor UNUSED,
-                                       CXClientData cd) {
-        if (!ctaw_childno) {
-                ctaw_childno++;
-                return CXChildVisit_Continue;
-        }
-
-        pair<optional<TypeInfo>, ASTContext *> *p =
-            static_cast<pair<optional<TypeInfo>, ASTContext *> *>(cd);
-        CXCursorKind kind = clang_getCursorKind(c);
-        string varname;
-        if (kind == CXCursor_DeclRefExpr) {
-                varname = get_cursor_spelling(c);
-        } else if (kind == CXCursor_CallExpr) {
-                string fq_method_name = get_fq_method(c);
-                p->second->lock.lock();
-                // See if we know the return type of the method.
-                if (p->second->function_names_to_return_unit.find(fq_method_name) == p->second->function_names_to_return_unit.end()) {
-                        p->second->lock.unlock();
-                        return CXChildVisit_Recurse;
-                }
-
-                TypeInfo ti = p->second->function_names_to_return_unit.at(fq_method_name);
-                p->second->lock.unlock();
-                p->first = ti;
-                return CXChildVisit_Break;
-        } else if (kind == CXCursor_BinaryOperator) {
-                string spelling = get_binary_operator(c);
-                if (spelling == "*") {
-                        pair<optional<TypeInfo>, ASTContext *> lhs_p = {{}, p->second};
-                        clang_visitChildren(c, type_check_rhs, &lhs_p);
-
-                        int old_ctaw = ctaw_childno;
-                        pair<optional<TypeInfo>, ASTContext *> rhs_p = {{}, p->second};
-                        ctaw_childno = 0;
-                        clang_visitChildren(c, type_check_rhs, &rhs_p);
-                        ctaw_childno = old_ctaw;
-
-                        if (lhs_p.first && lhs_p.first.value().dimension &&
-                            rhs_p.first && rhs_p.first.value().dimension) {
-                                    TypeInfo lhs_ti = lhs_p.first.value();
-                                    TypeInfo rhs_ti = rhs_p.first.value();
-                                    
-                                    set<int> frames;
-                                    frames.insert(lhs_ti.frames.begin(), lhs_ti.frames.end());
-                                    frames.insert(rhs_ti.frames.begin(), rhs_ti.frames.end());
-
-                                    set<int> units;
-                                    units.insert(lhs_ti.units.begin(), lhs_ti.units.end());
-                                    units.insert(rhs_ti.units.begin(), rhs_ti.units.end());
-
-                                    p->first = {
-                                            .frames = frames,
-                                            .units = units,
-                                            .source = {},
-                                            .dimension = lhs_ti.dimension.value() * rhs_ti.dimension.value(),
-                                    };
-                                    return CXChildVisit_Break;
-                        }
-                }
-                return CXChildVisit_Recurse;
-        } else if (kind == CXCursor_IntegerLiteral) {
-                CXEvalResult result = clang_Cursor_Evaluate(c);
-                int value = clang_EvalResult_getAsInt(result);
-                Dimension d = {
-                        .coefficients = {0, 0, 0, 0, 0, 0, 0},
-                        .scalar_numerator = value,
-                        .scalar_denominator = 1,
-                };
-                TypeInfo ti = {
-                        .frames = {},
-                        .units = {},
-                        .source = {},
-                        .dimension = d,
-                };
-                p->first = ti;
-                return CXChildVisit_Break;
-        } else {
-                return CXChildVisit_Recurse;
+                               ctx->type_to_field_to_unit, ctx->unit_dimensions,
+                               source, ctx->var_types.back());
+                return;
         }
 
-        bool is_param = p->second->current_fn_params.find(varname) !=
-                        p->second->current_fn_params.end();
-        if (is_param) {
-                TypeInfo ti;
-                // any frame.
-                for (int i = MAV_FRAME_GLOBAL; i < MAV_FRAME_NONE; i++)
-                        ti.frames.insert(i);
-                for (int i = 0; i < p->second->num_units; i++)
-                        ti.units.insert(i);
-                TypeSource source = {
-                    SOURCE_PARAM,
-                    p->second->param_to_number[varname],
-                    "",
-                };
-                ti.source.push_back(source);
-                p->first = ti;
-                return CXChildVisit_Break;
-        } else if (!varname.empty() && !p->second->var_types.empty()) {
-                optional<TypeInfo> ti = get_var_typeinfo(varname, p->second->var_types);
-                if (ti) {
-                        p->first = ti;
-                        return CXChildVisit_Break;
-                }
-        }
+        // the initializer is the last child of the declaration.
+        vector<CXCursor> children = get_children(cursor);
+        if (children.empty() || !clang_isExpression(clang_getCursorKind(children.back())))
+                return;
 
-        return CXChildVisit_Recurse;
+        spdlog::trace("(thread {}) typing initializer", ctx->thread_no);
+        const ExprType &init = type_expression(children.back(), ctx);
+        spdlog::trace("(thread {}) typed initializer", ctx->thread_no);
+        if (ctx->unit_constraints)
+                ctx->unit_constraints->equal(
+                    ctx->unit_constraints->variable(get_inference_name(ctx, cursor)),
+                    init.term);
+        if (init.type && !ctx->var_types.empty())
+                ctx->var_types.back()[get_cursor_spelling(cursor)] = init.type.value();
 }
 
 // Merges two type infos
@@ -795,23 +809,42 @@ void merge_typeinfo(TypeInfo &dst, const TypeInfo &src) {
         dst.source.insert(dst.source.end(), sources.begin(), sources.end());
 }
 
+// Returns true if t is the type of a numeric constant, which scales what
+// it is used with but has no unit of its own.
+static bool is_numeric_constant(const TypeInfo &t) {
+        return t.units.empty() && t.source.empty();
+}
+
+// Returns the name of the unit a store reports for t: the last of its units.
+static string reported_unit_name(const TypeInfo &t, const ASTContext *ctx) {
+        if (t.units.empty())
+                return "no unit";
+        return ctx->id_to_unitname.at(*t.units.rbegin());
+}
+
 // Checks if cursor stores (op =) a mavlink message field into another object
 void check_tainted_store(CXCursor cursor, ASTContext *ctx) {
-        pair<optional<TypeInfo>, ASTContext *> p({}, ctx);
-        // ctaw_childno = 0;
-        // clang_visitChildren(cursor, check_tainted_assgn_walker, &p);
-        // if (!p.first) {
-        //         ctaw_childno = 0;
-        //         clang_visitChildren(cursor, type_check_rhs, &p);
-        // }
-        ctaw_childno = 0;
-        clang_visitChildren(cursor, type_check_rhs, &p);
-        if (!p.first) {
-                ctaw_childno = 0;
-                clang_visitChildren(cursor, check_tainted_assgn_walker, &p);
-        }
-
-        if (p.first && !ctx->var_types.empty()) {
+        CXCursor lhs, rhs;
+        if (clang_getCursorKind(cursor) == CXCursor_CallExpr) {
+                // operator= takes the object as its first argument.
+                if (clang_Cursor_getNumArguments(cursor) != 2)
+                        return;
+                lhs = clang_Cursor_getArgument(cursor, 0);
+                rhs = clang_Cursor_getArgument(cursor, 1);
+        } else {
+                vector<CXCursor> children = get_children(cursor);
+                if (children.size() != 2)
+                        return;
+                lhs = children[0];
+                rhs = children[1];
+        }
+
+        const ExprType &rhs_expr = type_expression(rhs, ctx);
+        if (ctx->unit_constraints)
+                ctx->unit_constraints->equal(type_expression(lhs, ctx).term, rhs_expr.term);
+
+        const optional<TypeInfo> &rhs_type_info = rhs_expr.type;
+        if (rhs_type_info && !ctx->var_types.empty()) {
                 string varname = pretty_print_store(cursor);
 
                 pair<optional<string>, ASTContext *> data({}, ctx);
@@ -827,9 +860,10 @@ void check_tainted_store(CXCursor cursor, ASTContext *ctx) {
                                                          ASTContext *> *>(cd);
                                     data->first =
                                         get_member_access_str(data->second, c);
-                                    ofstream out("/home/ardupilot/variables",
-                                                 ios::app);
-                                    out << *data->first << endl;
+                                    if (data->second->variable_dump &&
+                                        data->second->owns_definition)
+                                            data->second->variable_dump->write(
+                                                *data->first);
                             }
                             return CXChildVisit_Break;
                     },
@@ -839,33 +873,26 @@ void check_tainted_store(CXCursor cursor, ASTContext *ctx) {
                         data.first = varname;
                 }
 
-                if (data.first && ctx->writes_to_variables_with_known_types.find(data.first.value()) != ctx->writes_to_variables_with_known_types.end()) {
-                        const TypeInfo &lhs_type_info = ctx->prior_var_to_typeinfo.at(data.first.value());
-                        if (p.first != lhs_type_info) {
-                                CXSourceLocation location = clang_getCursorLocation(cursor);
-                                CXFile file;
-                                unsigned line;
-                                clang_getSpellingLocation(location, &file, &line, nullptr, nullptr);
-                                CXString filename_cx = clang_getFileName(file);
-                                string filename = clang_getCString(filename_cx);
-                                clang_disposeString(filename_cx);
-
-                                int rhs_type = 0;
-                                for (const int type_id : p.first->units) {
-                                        rhs_type = type_id;
-                                }
-                                string rhs_type_name = ctx->id_to_unitname.at(rhs_type);
-
-                                int lhs_type = 0;
-                                for (const int type_id : lhs_type_info.units) {
-                                        lhs_type = type_id;
-                                }
-                                string lhs_type_name = ctx->id_to_unitname.at(lhs_type);
-
-                                cout << "Incorrect store to variable " << data.first.value() 
-                                     << " in " << filename << " line " << line 
-                                     << ". Got type " << rhs_type_name << ", expected type "
-                                     << lhs_type_name << "." << endl;
+                const TypeInfo *prior = data.first ? ctx->prior_types.find(data.first.value()) : nullptr;
+                // e.g. x.alt = 0.0f; the constant takes on the variable's unit.
+                if (prior && is_numeric_constant(rhs_type_info.value()))
+                        return;
+                if (prior) {
+                        const TypeInfo &lhs_type_info = *prior;
+                        if (rhs_type_info != lhs_type_info) {
+                                Diagnostic d;
+                                d.kind = DIAG_INCORRECT_STORE;
+                                get_location(cursor, d.file, d.line);
+                                d.variable = data.first.value();
+
+                                d.actual = reported_unit_name(rhs_type_info.value(), ctx);
+                                d.expected = reported_unit_name(lhs_type_info, ctx);
+
+                                d.message = "Incorrect store to variable " + d.variable +
+                                            " in " + d.file + " line " + to_string(d.line) +
+                                            ". Got type " + d.actual + ", expected type " +
+                                            d.expected + ".";
+                                report_parse_diagnostic(ctx, d);
                         }
 
                         ctx->lock.lock();
@@ -876,11 +903,11 @@ void check_tainted_store(CXCursor cursor, ASTContext *ctx) {
                                       data.first.value());
                         merge_typeinfo(
                             ctx->store_to_typeinfo[data.first.value()],
-                            p.first.value());
-                        ctx->var_types.back()[*data.first] = p.first.value();
+                            rhs_type_info.value());
+                        ctx->var_types.back()[*data.first] = rhs_type_info.value();
                 } else if (data.first) {
                         // TODO: validate performance on ArduPilot
-                        ctx->var_types.back()[data.first.value()] = p.first.value();
+                        ctx->var_types.back()[data.first.value()] = rhs_type_info.value();
                 }
         }
 }
@@ -896,64 +923,21 @@ void unify_scopes(map<string, TypeInfo> &old,
         }
 }
 
-enum CXChildVisitResult type_cursor_walker(CXCursor cursor, CXCursor UNUSED,
-                                           CXClientData client_data) {
-        pair<TypeInfo, ASTContext *> *p =
-            static_cast<pair<TypeInfo, ASTContext *> *>(client_data);
-        CXCursorKind kind = clang_getCursorKind(cursor);
-        if (kind == CXCursor_DeclRefExpr) {
-                // check if this is a variable with a known type
-                string varname = get_cursor_spelling(cursor);
-                optional<TypeInfo> ti =
-                    get_var_typeinfo(varname, p->second->var_types);
-                if (ti) {
-                        p->first = ti.value();
-                } else {
-                        // this shouldn't happen?
-                        for (int i = 0; i < MAV_FRAME_NONE; i++)
-                                p->first.frames.insert(i);
-                        for (int i = 0; i < p->second->num_units; i++)
-                                p->first.units.insert(i);
-                        p->first.source.push_back({SOURCE_UNKNOWN, 0, ""});
-                }
-                return CXChildVisit_Break;
-        } else if (kind == CXCursor_MemberRefExpr) {
-                string access = pretty_print_memberRefExpr(cursor);
-                optional<TypeInfo> ti =
-                    get_var_typeinfo(access, p->second->var_types);
-                if (ti) {
-                        p->first = ti.value();
-                        return CXChildVisit_Break;
-                } else {
-                        optional<string> stored_object = get_first_decl(cursor);
-                        if (stored_object) {
-                                optional<TypeInfo> ti =
-                                    get_var_typeinfo(stored_object.value(),
-                                                     p->second->var_types);
-                        } else {
-                                for (int i = 0; i < MAV_FRAME_NONE; i++)
-                                        p->first.frames.insert(i);
-                                for (int i = 0; i < p->second->num_units; i++)
-                                        p->first.units.insert(i);
-                                p->first.source.push_back(
-                                    {SOURCE_UNKNOWN, 0, ""});
-                        }
-                }
-        }
-        return CXChildVisit_Recurse;
-}
-
 // returns the type associated with the cursor at c
 TypeInfo type_cursor(CXCursor c, ASTContext *ctx) {
-        // Our typing algorithm is simple at the moment.
-        //   * If cursor refers to a variable in the ASTContext,
-        //     return the type information associated with the variable.
-        //   * If cursor refers to another expression, return the first known
-        //   type.
-        //     If there is no known type, produce a universal type.
-        pair<TypeInfo, ASTContext *> p({}, ctx);
-        clang_visitChildren(c, type_cursor_walker, &p);
-        return p.first;
+        // If no part of the expression has a known type, produce a universal
+        // type.
+        const ExprType &t = type_expression(c, ctx);
+        if (t.type)
+                return t.type.value();
+
+        TypeInfo universal;
+        for (int i = 0; i < MAV_FRAME_NONE; i++)
+                universal.frames.insert(i);
+        for (int i = 0; i < ctx->num_units; i++)
+                universal.units.insert(i);
+        universal.source.push_back({SOURCE_UNKNOWN, 0, ""});
+        return universal;
 }
 
 enum CXChildVisitResult function_ast_walker(CXCursor cursor, CXCursor UNUSED,
@@ -1112,12 +1096,21 @@ enum CXChildVisitResult function_ast_walker(CXCursor cursor, CXCursor UNUSED,
                         // TODO: use taint information
                 } else if (!spelling.empty()) {
                         int num_args = clang_Cursor_getNumArguments(cursor);
+                        string callee = ctx->unit_constraints ? get_inference_callee(cursor) : "";
                         vector<TypeInfo> call_info;
                         for (int i = 0; i < num_args; i++) {
                                 CXCursor arg =
                                     clang_Cursor_getArgument(cursor, i);
                                 TypeInfo t = type_cursor(arg, ctx);
                                 call_info.push_back(t);
+
+                                // bind the argument to the callee's parameter.
+                                if (ctx->unit_constraints) {
+                                        Term param = ctx->unit_constraints->variable(
+                                            callee + "::#" + to_string(i));
+                                        ctx->unit_constraints->equal(
+                                            param, type_expression(arg, ctx).term);
+                                }
                         }
 
                         string this_fn = ctx->current_fn;
@@ -1139,12 +1132,19 @@ enum CXChildVisitResult function_ast_walker(CXCursor cursor, CXCursor UNUSED,
                                        ctx->type_to_field_to_unit.end();
                 string param_name = get_cursor_spelling(cursor);
                 ctx->param_to_number[param_name] = ctx->total_params;
+                if (ctx->unit_constraints) {
+                        Term param = ctx->unit_constraints->variable(
+                            ctx->current_qualified_fn + "::#" + to_string(ctx->total_params));
+                        ctx->unit_constraints->equal(
+                            param, ctx->unit_constraints->variable(
+                                       ctx->current_qualified_fn + "::" + param_name));
+                }
                 if (is_mav_type) {
                         TypeSource source = {SOURCE_INTRINSIC,
                                              ctx->total_params, ""};
                         add_inner_vars(t_type, param_name,
-                                       ctx->type_to_field_to_unit, source,
-                                       ctx->var_types.back());
+                                       ctx->type_to_field_to_unit, ctx->unit_dimensions,
+                                       source, ctx->var_types.back());
                         ctx->param_to_typesource_kind[ctx->total_params] =
                             SOURCE_INTRINSIC;
                         ctx->lock.lock();
@@ -1162,6 +1162,14 @@ enum CXChildVisitResult function_ast_walker(CXCursor cursor, CXCursor UNUSED,
                 }
                 ctx->total_params++;
                 spdlog::trace("(thread {}) done parm decl", ctx->thread_no);
+        } else if (kind == CXCursor_ReturnStmt && ctx->unit_constraints) {
+                vector<CXCursor> children = get_children(cursor);
+                if (!children.empty()) {
+                        Term ret = ctx->unit_constraints->variable(
+                            ctx->current_qualified_fn + "::#return");
+                        ctx->unit_constraints->equal(
+                            ret, type_expression(children[0], ctx).term);
+                }
         } else if (kind == CXCursor_CompoundStmt) {
                 spdlog::trace("(thread {}) in compound statement",
                               ctx->thread_no);
@@ -1173,6 +1181,9 @@ enum CXChildVisitResult function_ast_walker(CXCursor cursor, CXCursor UNUSED,
                         else
                                 // this is tricky part i
                                 ctx->had_fn_definition = true;
+                        if (!ctx->had_fn_definition && ctx->claimed_definitions)
+                                ctx->owns_definition =
+                                    ctx->claimed_definitions->insert(ctx->current_usr).second;
                         ctx->lock.unlock();
                         // this is tricky part ii
                         ctx->had_fn_definition = !ctx->had_fn_definition;
@@ -1195,7 +1206,7 @@ enum CXChildVisitResult ast_walker(CXCursor cursor, CXCursor UNUSED,
                                    CXClientData client_data) {
         CXCursorKind kind = clang_getCursorKind(cursor);
         if (kind == CXCursor_FunctionDecl || kind == CXCursor_CXXMethod) {
-                // TODO: handle overloading + overriding
+                // TODO: handle overloading
                 ASTContext *ctx = static_cast<ASTContext *>(client_data);
                 string usr = get_cursor_usr(cursor);
 
@@ -1212,6 +1223,9 @@ enum CXChildVisitResult ast_walker(CXCursor cursor, CXCursor UNUSED,
                 ctx->had_taint = false;
                 ctx->current_fn = get_cursor_spelling(cursor);
                 ctx->current_usr = usr;
+                ctx->current_qualified_fn = get_qualified_name(cursor);
+                ctx->owns_definition = true;
+                ctx->expr_types.clear();
 
                 map<string, TypeInfo> scope;
                 ctx->var_types.push_back(scope);
@@ -1223,29 +1237,26 @@ enum CXChildVisitResult ast_walker(CXCursor cursor, CXCursor UNUSED,
                         cout << "working in InitialiseVariables" << endl;
                 }
 
-                int old_ctx_len = ctx->semantic_context.length();
-                if (kind == CXCursor_CXXMethod) {
-                        CXCursor semantic_parent =
-                            clang_getCursorSemanticParent(cursor);
-                        string semantic_spelling =
-                            get_cursor_spelling(semantic_parent);
-                        if (ctx->semantic_context.empty())
-                                ctx->semantic_context = semantic_spelling;
-                        else
-                                ctx->semantic_context =
-                                    ctx->semantic_context +
-                                    "::" + semantic_spelling;
-                }
+                size_t old_ctx_size = ctx->semantic_context.size();
+                if (kind == CXCursor_CXXMethod)
+                        append_spelling(ctx->semantic_context,
+                                        clang_getCursorSemanticParent(cursor));
+                PathIndex::Probe old_ctx_probe = ctx->semantic_context_probe;
+                PathBuilder ctx_path;
+                append_semantic_context(ctx_path, ctx);
+                ctx->semantic_context_probe = ctx->prior_types.step_path(
+                    ctx->prior_types.root(), ctx_path);
 
                 clang_visitChildren(cursor, function_ast_walker, client_data);
 
                 if (ctx->had_taint && ctx->had_fn_definition &&
                     !ctx->had_mav_constraint) {
-                        CXString cursor_spelling =
-                            clang_getCursorSpelling(cursor);
-                        cout << "BUG: unconstrained MAV frame used in: "
-                             << clang_getCString(cursor_spelling) << endl;
-                        clang_disposeString(cursor_spelling);
+                        Diagnostic d;
+                        d.kind = DIAG_UNCONSTRAINED_FRAME;
+                        get_location(cursor, d.file, d.line);
+                        d.trace = {get_cursor_spelling(cursor)};
+                        d.message = "BUG: unconstrained MAV frame used in: " + d.trace[0];
+                        report_parse_diagnostic(ctx, d);
                 }
 
                 if (ctx->had_fn_definition) {
@@ -1254,7 +1265,9 @@ enum CXChildVisitResult ast_walker(CXCursor cursor, CXCursor UNUSED,
                         ctx->fn_summary[name].num_params = ctx->total_params;
                         ctx->fn_summary[name].param_to_typesource_kind.swap(
                             ctx->param_to_typesource_kind);
-                        ctx->name_to_tu[name].insert(ctx->translation_unit_no);
+                        ctx->fn_summary[name].usrs.insert(usr);
+                        if (ctx->owns_definition)
+                                ctx->name_to_tu[name].insert(ctx->translation_unit_no);
                         ctx->fn_summary[name].store_to_typeinfo.swap(
                             ctx->store_to_typeinfo);
                         ctx->lock.unlock();
@@ -1266,8 +1279,8 @@ enum CXChildVisitResult ast_walker(CXCursor cursor, CXCursor UNUSED,
                 ctx->param_to_number.clear();
                 ctx->param_to_typesource_kind.clear();
                 ctx->total_params = 0;
-                if (kind == CXCursor_CXXMethod)
-                        ctx->semantic_context.erase(old_ctx_len);
+                ctx->semantic_context.truncate(old_ctx_size);
+                ctx->semantic_context_probe = old_ctx_probe;
                 ctx->store_to_typeinfo.clear();
 
                 spdlog::trace("(thread {}) done with {}", ctx->thread_no,
@@ -1279,12 +1292,11 @@ enum CXChildVisitResult ast_walker(CXCursor cursor, CXCursor UNUSED,
         return CXChildVisit_Recurse;
 }
 
-static map<string, TypeInfo>
-vars_to_typeinfo(const vector<VariableEntry> &vars,
-                 map<string, int> &unit_to_id,
-                 int &type_id) {
-        map<string, TypeInfo> results;
-        const map<string, MAVFrame> frame_to_field = {
+// Adds the type of the prior variable ve to results.
+static void add_prior_type(map<string, TypeInfo> &results,
+                           const VariableEntry &ve,
+                           map<string, int> &unit_to_id, int &type_id) {
+        static const map<string, MAVFrame> frame_to_field = {
             {"MAV_FRAME_GLOBAL", MAV_FRAME_GLOBAL},
             {"MAV_FRAME_LOCAL_NED", MAV_FRAME_LOCAL_NED},
             {"MAV_FRAME_MISSION", MAV_FRAME_MISSION},
@@ -1303,35 +1315,31 @@ vars_to_typeinfo(const vector<VariableEntry> &vars,
             {"MAV_FRAME_LOCAL_FRD", MAV_FRAME_LOCAL_FRD},
             {"MAV_FRAME_LOCAL_FLU", MAV_FRAME_LOCAL_FLU},
             {"MAV_FRAME_NONE", MAV_FRAME_NONE}};
-        for (const auto &ve : vars) {
-                TypeInfo ti;
-                for (const auto &fr : ve.semantic_info.coordinate_frames) {
-                        const auto &it = frame_to_field.find(fr);
-                        if (it == frame_to_field.end())
-                                ti.frames.insert(MAV_FRAME_NONE);
-                        else
-                                ti.frames.insert(it->second);
-                }
-                for (const auto &unit_name : ve.semantic_info.units) {
-                        const auto &it = unit_to_id.find(unit_name);
-                        if (it == unit_to_id.end()) {
-                                unit_to_id[unit_name] = type_id;
-                                ti.units.insert(type_id);
-                                type_id++;
-                        } else {
-                                ti.units.insert(it->second);
-                        }
-                        ti.dimension = string_to_dimension(unit_name);
+        TypeInfo ti;
+        for (const auto &fr : ve.semantic_info.coordinate_frames) {
+                const auto &it = frame_to_field.find(fr);
+                if (it == frame_to_field.end())
+                        ti.frames.insert(MAV_FRAME_NONE);
+                else
+                        ti.frames.insert(it->second);
+        }
+        for (const auto &unit_name : ve.semantic_info.units) {
+                const auto &it = unit_to_id.find(unit_name);
+                if (it == unit_to_id.end()) {
+                        unit_to_id[unit_name] = type_id;
+                        ti.units.insert(type_id);
+                        type_id++;
+                } else {
+                        ti.units.insert(it->second);
                 }
-                ti.source.push_back({SOURCE_INTRINSIC, -1, ""});
-                results[ve.variable_name] = ti;
+                ti.dimension = string_to_dimension_id(unit_name);
         }
-
-        return results;
+        ti.source.push_back({SOURCE_INTRINSIC, -1, ""});
+        results[ve.variable_name] = ti;
 }
 
-void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
-             const set<string> &interesting_writes,
+void do_work(CXCompileCommands cmds, const vector<unsigned> &work,
+             unsigned thread_no, unsigned stride,
              set<string> &functions_with_intrinsic_variables,
              unordered_set<string> &seen_definitions,
              const map<string, string> &type_to_semantic,
@@ -1339,12 +1347,20 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
              vector<map<string, FunctionSummary>> &fn_summaries,
              unordered_map<string, set<unsigned>> &name_to_tu, mutex &lock,
              int num_units, int &file_no, mutex &cout_lock,
-             const map<string, TypeInfo> &prior_type_to_typeinfo,
-             map<string, TypeInfo> &function_name_to_return_unit_type,
-             const map<int, string> &id_to_unitname) {
-        unsigned num_cmds = clang_CompileCommands_getSize(cmds);
+             const PathIndex &prior_types,
+             const PerfectHashTable<TypeInfo> &function_name_to_return_unit_type,
+             const map<int, string> &id_to_unitname,
+             const vector<optional<DimensionId>> &unit_dimensions,
+             UnitConstraints *unit_constraints,
+             AsyncLineWriter *variable_dump, DiagnosticsSink *diagnostics,
+             vector<vector<Diagnostic>> &parse_diagnostics,
+             bool share_definitions) {
         CXIndex index = clang_createIndex(0, 0);
-        for (auto i = thread_no; i < num_cmds; i += stride) {
+        optional<AsyncLineWriter::Buffer> variable_dump_buffer;
+        if (variable_dump)
+                variable_dump_buffer.emplace(*variable_dump);
+        for (auto k = thread_no; k < work.size(); k += stride) {
+                unsigned i = work[k];
                 CXCompileCommand cmd =
                     clang_CompileCommands_getCommand(cmds, i);
 
@@ -1353,7 +1369,7 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
                 CXString compile_dir = clang_CompileCommand_getDirectory(cmd);
 
                 cout_lock.lock();
-                cout << ++file_no << "/" << num_cmds << " "
+                cout << ++file_no << "/" << work.size() << " "
                      << clang_getCString(filename) << endl;
                 cout_lock.unlock();
 
@@ -1386,6 +1402,16 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
                 map<string, int> param_to_number;
                 map<int, TypeSourceKind> param_to_typesource_kind;
                 map<string, TypeInfo> current_interesting_writes;
+                unordered_map<CXCursor, ExprType, CursorHash, CursorEqual> expr_types;
+                ConstantEvaluator constants;
+                ClassHierarchy hierarchy;
+                if (unit)
+                        hierarchy.add_translation_unit(unit);
+                // unless definitions are shared, each TU summarizes every
+                // function it defines, so its summaries do not depend on the
+                // TUs parsed before it. The analysis still uses one summary
+                // per definition, from the TU that claims it first.
+                unordered_set<string> tu_definitions;
                 ASTContext ctx = {
                     .types_to_frame_field = type_to_semantic,
                     .type_to_field_to_unit = type_to_field_to_unit,
@@ -1400,6 +1426,7 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
                     .fn_summary = fn_summaries[i],
                     .current_fn = "",
                     .current_usr = "",
+                    .current_qualified_fn = "",
                     .current_fn_params = current_fn_params,
                     .param_to_number = param_to_number,
                     .param_to_typesource_kind = param_to_typesource_kind,
@@ -1407,16 +1434,26 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
                     .name_to_tu = name_to_tu,
                     .had_fn_definition = false,
                     .translation_unit_no = i,
-                    .semantic_context = "",
-                    .writes_to_variables_with_known_types = interesting_writes,
+                    .semantic_context = {},
+                    .semantic_context_probe = prior_types.step_path(prior_types.root(), ""),
                     .store_to_typeinfo = current_interesting_writes,
                     .functions_with_intrinsic_variables = functions_with_intrinsic_variables,
-                    .seen_definitions = seen_definitions,
+                    .seen_definitions = share_definitions ? seen_definitions : tu_definitions,
+                    .claimed_definitions = share_definitions ? nullptr : &seen_definitions,
+                    .owns_definition = true,
                     .lock = lock,
                     .thread_no = static_cast<int>(thread_no),
-                    .prior_var_to_typeinfo = prior_type_to_typeinfo,
+                    .prior_types = prior_types,
                     .function_names_to_return_unit = function_name_to_return_unit_type,
                     .id_to_unitname = id_to_unitname,
+                    .unit_dimensions = unit_dimensions,
+                    .unit_constraints = unit_constraints,
+                    .hierarchy = hierarchy,
+                    .constants = constants,
+                    .expr_types = expr_types,
+                    .variable_dump = variable_dump_buffer ? &*variable_dump_buffer : nullptr,
+                    .diagnostics = diagnostics,
+                    .tu_diagnostics = parse_diagnostics[i],
                 };
                 if (unit) {
                         CXCursor cursor = clang_getTranslationUnitCursor(unit);
@@ -1428,6 +1465,7 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
                 }
 
                 // free memory from (3 b ii)
+                reset_fq_method_cache();
                 clang_disposeTranslationUnit(unit);
 
                 // free memory from (3 b i)
@@ -1442,17 +1480,463 @@ void do_work(CXCompileCommands cmds, unsigned thread_no, unsigned stride,
         clang_disposeIndex(index);
 }
 
-MessageDefinitionType detect_definition_type(const pugi::xml_document &doc) {
-        if (doc.child("mavlink")) {
-                return MAVLINK;
+// Returns the human-readable names of the units ti can take on.
+string format_units(const TypeInfo &ti, const map<int, string> &id_to_unitname) {
+        if (ti.units.empty())
+                return "no unit";
+        if (ti.units.size() == id_to_unitname.size())
+                return "any unit";
+        string result, sep;
+        for (int unit : ti.units) {
+                const auto &it = id_to_unitname.find(unit);
+                result += sep + (it == id_to_unitname.end() ? to_string(unit) : it->second);
+                sep = " | ";
+        }
+        return result;
+}
+
+// Collects the identifiers whose mention makes a translation unit worth
+// parsing: message structs, accessors and the names of prior-typed
+// variables. Returns false if a prior pattern makes that impossible.
+static bool get_prescan_identifiers(const MessageSpec &spec,
+                                    const map<string, TypeInfo> &priors,
+                                    vector<string> &identifiers) {
+        auto last_component = [](const string &name) {
+                size_t sep = name.rfind("::");
+                return sep == string::npos ? name : name.substr(sep + 2);
+        };
+        for (const auto &type : spec.type_to_semantic)
+                identifiers.push_back(type.first);
+        for (const auto &type : spec.type_to_field_to_unit)
+                identifiers.push_back(type.first);
+        for (const auto &fn : spec.function_to_return_type)
+                identifiers.push_back(last_component(fn.first));
+        for (const auto &prior : priors) {
+                string name = last_component(prior.first);
+                if (PathIndex::is_pattern(name))
+                        return false;
+                identifiers.push_back(name);
+        }
+        return true;
+}
+
+// Returns the arguments of cmd.
+static vector<string> get_command_args(CXCompileCommand cmd) {
+        vector<string> args;
+        unsigned num_args = clang_CompileCommand_getNumArgs(cmd);
+        for (unsigned j = 0; j < num_args; j++) {
+                CXString arg = clang_CompileCommand_getArg(cmd, j);
+                args.push_back(clang_getCString(arg));
+                clang_disposeString(arg);
+        }
+        return args;
+}
+
+// Returns the main file of cmd, made absolute.
+static string get_command_file(CXCompileCommand cmd) {
+        CXString filename = clang_CompileCommand_getFilename(cmd);
+        CXString compile_dir = clang_CompileCommand_getDirectory(cmd);
+        string path = get_full_path(compile_dir, filename);
+        clang_disposeString(filename);
+        clang_disposeString(compile_dir);
+        return path;
+}
+
+/**
+ * Returns what identifies the preprocessor input of cmd: its main file,
+ * directory and arguments, less those that only name its outputs,
+ * dependency files or warnings. Commands with the same key parse the same.
+ */
+static string get_command_key(CXCompileCommand cmd) {
+        // options that name an output or a dependency file, followed by it
+        static const set<string> output_options = {"-o", "-MF", "-MT", "-MQ"};
+
+        // the key keeps the directory, as relative -I paths and generated
+        // headers depend on it.
+        CXString compile_dir = clang_CompileCommand_getDirectory(cmd);
+        string key = get_command_file(cmd) + '\0' + clang_getCString(compile_dir);
+        clang_disposeString(compile_dir);
+        vector<string> args = get_command_args(cmd);
+        for (size_t j = 0; j < args.size(); j++) {
+                const string &arg = args[j];
+                if (output_options.count(arg)) {
+                        j++;
+                        continue;
+                }
+                if (arg == "-c" || arg == "-MD" || arg == "-MMD" ||
+                    (arg.compare(0, 2, "-o") == 0) ||
+                    (arg.compare(0, 2, "-W") == 0 && arg.compare(0, 4, "-Wp,") != 0))
+                        continue;
+                key += '\0' + arg;
+        }
+        return key;
+}
+
+// Counts what select_commands dropped.
+struct CommandSelection {
+        unsigned excluded = 0;
+        unsigned duplicates = 0;
+};
+
+/**
+ * Returns the indices of the commands in cmds to analyze: those whose main
+ * file matches one of includes (if any) and none of excludes, once per
+ * distinct preprocessor input. Commands that differ only in their outputs,
+ * dependency files or warnings, e.g. the same source listed again for
+ * another output, count as one.
+ */
+static vector<unsigned> select_commands(CXCompileCommands cmds,
+                                        const vector<string> &includes,
+                                        const vector<string> &excludes,
+                                        CommandSelection &selection) {
+        vector<unsigned> work;
+        unordered_set<string> seen;
+        unsigned num_cmds = clang_CompileCommands_getSize(cmds);
+        for (unsigned i = 0; i < num_cmds; i++) {
+                CXCompileCommand cmd = clang_CompileCommands_getCommand(cmds, i);
+                string file = get_command_file(cmd);
+                auto matches = [&file](const string &pattern) { return glob_match(pattern, file); };
+                if ((!includes.empty() && none_of(includes.begin(), includes.end(), matches)) ||
+                    any_of(excludes.begin(), excludes.end(), matches)) {
+                        selection.excluded++;
+                        continue;
+                }
+                if (!seen.insert(get_command_key(cmd)).second) {
+                        selection.duplicates++;
+                        continue;
+                }
+                work.push_back(i);
+        }
+        return work;
+}
+
+// Returns the main files and include directories of the commands in work.
+// Adds the value of an option of a compile command that names a path to
+// unit, e.g. the directory of -I or the file of -include.
+static void add_prescan_path(PrescanUnit &unit, const string &option, const string &path) {
+        if (option == "-I" || option == "-iquote")
+                unit.include_dirs.push_back(path);
+        else if (option == "-isystem" || option == "-idirafter")
+                unit.system_dirs.push_back(path);
+        else
+                unit.forced_includes.push_back(path);
+}
+
+static vector<PrescanUnit> get_prescan_units(CXCompileCommands cmds,
+                                             const vector<unsigned> &work) {
+        vector<PrescanUnit> units;
+        for (unsigned i : work) {
+                CXCompileCommand cmd = clang_CompileCommands_getCommand(cmds, i);
+                PrescanUnit unit;
+                CXString filename = clang_CompileCommand_getFilename(cmd);
+                CXString compile_dir = clang_CompileCommand_getDirectory(cmd);
+                unit.file = clang_getCString(filename);
+                unit.directory = clang_getCString(compile_dir);
+                clang_disposeString(filename);
+                clang_disposeString(compile_dir);
+
+                static const string path_options[] = {"-I", "-iquote", "-isystem", "-idirafter",
+                                                      "-include", "-imacros"};
+                // the option the argument is the path of, if any
+                string option;
+                for (const auto &arg : get_command_args(cmd)) {
+                        if (!option.empty()) {
+                                add_prescan_path(unit, option, arg);
+                                option.clear();
+                                continue;
+                        }
+                        for (const auto &path_option : path_options) {
+                                if (arg.compare(0, path_option.size(), path_option) != 0)
+                                        continue;
+                                if (arg.size() == path_option.size())
+                                        option = path_option;
+                                // a precompiled header is not a source file.
+                                else if (arg != "-include-pch")
+                                        add_prescan_path(unit, path_option, arg.substr(path_option.size()));
+                                break;
+                        }
+                }
+                units.push_back(unit);
+        }
+        return units;
+}
+
+// Returns s quoted for the shell.
+static string shell_quote(const string &s) {
+        string quoted = "'";
+        for (char c : s) {
+                if (c == '\'')
+                        quoted += "'\\''";
+                else
+                        quoted += c;
+        }
+        return quoted + "'";
+}
+
+// Runs command and adds the lines it prints to lines. Returns an empty
+// string on success, or else why it failed.
+static string read_command_lines(const string &command, vector<string> &lines) {
+        FILE *pipe = popen(command.c_str(), "r");
+        if (!pipe)
+                return strerror(errno);
+        string line;
+        char buffer[4096];
+        while (fgets(buffer, sizeof(buffer), pipe)) {
+                line += buffer;
+                if (line.back() == '\n') {
+                        line.pop_back();
+                        lines.push_back(line);
+                        line.clear();
+                }
+        }
+        if (!line.empty())
+                lines.push_back(line);
+        if (pclose(pipe) != 0)
+                return command + " failed";
+        return "";
+}
+
+/**
+ * Adds the files that differ between rev and the working tree of the git
+ * repository containing dir to files, made absolute. Files that still exist
+ * are canonical, so they compare equal to the includes the prescan
+ * resolves. Returns an empty string on success, or else why it failed.
+ */
+static string get_changed_files(const string &dir, const string &rev,
+                                unordered_set<string> &files) {
+        if (rev.empty() || rev[0] == '-')
+                return "not a revision: " + rev;
+        string git = "git -C " + shell_quote(dir) + " -c core.quotePath=false";
+        vector<string> toplevel, changed;
+        string error = read_command_lines(git + " rev-parse --show-toplevel", toplevel);
+        if (!error.empty())
+                return error;
+        if (toplevel.size() != 1)
+                return dir + " is not in a git repository";
+        error = read_command_lines(git + " diff --name-only --no-renames " +
+                                       shell_quote(rev) + " --",
+                                   changed);
+        if (!error.empty())
+                return error;
+        for (const auto &file : changed) {
+                string path = toplevel[0] + "/" + file;
+                char resolved[PATH_MAX];
+                files.insert(realpath(path.c_str(), resolved) ? resolved : path);
+        }
+        return "";
+}
+
+// Returns the unit names, by unit ID.
+static vector<string> get_unit_names(const map<int, string> &id_to_unitname) {
+        vector<string> names;
+        for (const auto &unit : id_to_unitname)
+                names.push_back(unit.second);
+        return names;
+}
+
+/**
+ * Loads the summaries of the commands in work that the store at path has
+ * and removes those commands from work, leaving the ones to parse. Adds
+ * the definitions they use to seen_definitions. Returns an empty string on
+ * success, or else why the store cannot be used.
+ */
+static string load_summaries(const string &path, CXCompileCommands cmds,
+                             const vector<string> &unit_names,
+                             vector<unsigned> &work,
+                             vector<map<string, FunctionSummary>> &fn_summaries,
+                             unordered_map<string, set<unsigned>> &name_to_tu,
+                             set<string> &functions_with_intrinsic_variables,
+                             vector<vector<Diagnostic>> &parse_diagnostics,
+                             unordered_set<string> &seen_definitions) {
+        SummaryStore store(path);
+        if (!store.ok())
+                return store.error();
+        if (store.unit_names() != unit_names)
+                return "written for other message definitions";
+
+        unordered_map<string_view, unsigned> stored;
+        for (unsigned tu = 0; tu < store.num_translation_units(); tu++)
+                stored.emplace(store.translation_unit_key(tu), tu);
+        vector<unsigned> remaining;
+        for (unsigned i : work) {
+                string key = get_command_key(clang_CompileCommands_getCommand(cmds, i));
+                const auto &it = stored.find(key);
+                if (it == stored.end()) {
+                        remaining.push_back(i);
+                        continue;
+                }
+                store.load_translation_unit(it->second, i, fn_summaries, name_to_tu,
+                                            functions_with_intrinsic_variables,
+                                            seen_definitions);
+                parse_diagnostics[i] = store.diagnostics(it->second);
+        }
+        work.swap(remaining);
+        return "";
+}
+
+// Returns the summaries of the commands in tus.
+static SummarySnapshot get_snapshot(CXCompileCommands cmds, const vector<unsigned> &tus,
+                                    const vector<string> &unit_names,
+                                    const vector<map<string, FunctionSummary>> &fn_summaries,
+                                    const set<string> &functions_with_intrinsic_variables,
+                                    const vector<vector<Diagnostic>> &parse_diagnostics) {
+        SummarySnapshot snapshot = {
+            .translation_units = {},
+            .fn_summaries = fn_summaries,
+            .functions_with_intrinsic_variables = functions_with_intrinsic_variables,
+            .parse_diagnostics = parse_diagnostics,
+            .unit_names = unit_names,
+        };
+        for (unsigned i : tus) {
+                CXCompileCommand cmd = clang_CompileCommands_getCommand(cmds, i);
+                snapshot.translation_units.push_back({i, get_command_file(cmd), get_command_key(cmd)});
+        }
+        return snapshot;
+}
+
+/**
+ * Sets context to a SHA-256 digest of what the summaries of every
+ * translation unit depend on: the analyzer itself, which has no version to
+ * go by, the message spec and the prior types. Returns an empty string on
+ * success, or else why it failed.
+ */
+static string get_cache_context(const MessageSpec &spec, const string &prior_types_path,
+                                Sha256::Digest &context) {
+        Sha256 hasher;
+        // each file is preceded by its size, so that their bytes cannot
+        // shift from one to the next.
+        auto add_file = [&hasher](const string &path) -> string {
+                MappedFile file(path);
+                if (!file.ok())
+                        return path + ": " + file.error();
+                uint64_t size = file.size();
+                hasher.update(&size, sizeof(size));
+                hasher.update(file.data(), file.size());
+                return "";
+        };
+        string error = add_file("/proc/self/exe");
+        if (!error.empty())
+                return "cannot read the analyzer: " + error;
+        for (const auto &source : spec.sources) {
+                error = add_file(source.path);
+                if (!error.empty())
+                        return error;
+        }
+        error = add_file(prior_types_path);
+        if (!error.empty())
+                return error;
+        context = hasher.digest();
+        return "";
+}
+
+// Loads the message definitions at paths and the files they include.
+static MessageSpec load_message_spec(const vector<string> &paths) {
+        MessageSpec spec;
+        string error = load_message_definitions(paths, spec);
+        if (!error.empty()) {
+                spdlog::critical("cannot load message XML {}", error);
+                exit(1);
+        }
+        return spec;
+}
+
+// sa4u compile-spec: compiles a message spec so that later runs can load it
+// with --compiled-spec instead of parsing its XML.
+static int compile_spec(int argc, char **argv) {
+        cxxopts::Options options("sa4u compile-spec",
+                                 "compile a message spec for --compiled-spec");
+        // clang-format off
+        options.add_options()
+          ("m,message-definition",
+           "path to XML file containing the message spec; may be repeated",
+           cxxopts::value<vector<string>>())
+          ("o,output",
+           "path to write the compiled spec to",
+           cxxopts::value<string>())
+          ("h,help",
+           "print this message and exit");
+        // clang-format on
+
+        cxxopts::ParseResult result = options.parse(argc, argv);
+        if (result.count("help")) {
+                cout << options.help() << endl;
+                return 0;
+        }
+        if (!result.count("message-definition") || !result.count("output")) {
+                cerr << options.help() << endl;
+                return 1;
+        }
+
+        string output_path = result["output"].as<string>();
+        MessageSpec spec = load_message_spec(result["message-definition"].as<vector<string>>());
+        string error = write_compiled_spec(output_path, spec);
+        if (!error.empty()) {
+                spdlog::critical("cannot write compiled spec {}: {}", output_path, error);
+                return 1;
+        }
+        return 0;
+}
+
+// sa4u cache-stats: reports how a summary cache is used, and trims it.
+static int cache_stats(int argc, char **argv) {
+        cxxopts::Options options("sa4u cache-stats",
+                                 "report the use and size of a summary cache");
+        // clang-format off
+        options.add_options()
+          ("d,cache-dir",
+           "the cache directory",
+           cxxopts::value<string>())
+          ("max-size",
+           "first evict the least recently used entries until the cache "
+           "takes at most this many MiB",
+           cxxopts::value<uint64_t>())
+          ("h,help",
+           "print this message and exit");
+        // clang-format on
+
+        cxxopts::ParseResult result = options.parse(argc, argv);
+        if (result.count("help")) {
+                cout << options.help() << endl;
+                return 0;
+        }
+        if (!result.count("cache-dir")) {
+                cerr << options.help() << endl;
+                return 1;
+        }
+
+        string cache_dir = result["cache-dir"].as<string>();
+        // statistics and eviction do not look at keys, so any context does.
+        SummaryCache cache(cache_dir, Sha256::Digest());
+        if (result.count("max-size")) {
+                cache.evict(result["max-size"].as<uint64_t>() << 20);
+                cache.flush();
         }
-        if (doc.child("MDM")) {
-                return LMCP;
+        CacheStatistics totals;
+        uint64_t entries, bytes, temporaries, temporary_bytes;
+        string error = cache.statistics(totals, entries, bytes, temporaries, temporary_bytes);
+        if (!error.empty()) {
+                spdlog::critical("cannot read cache {}: {}", cache_dir, error);
+                return 1;
         }
-        return UNKNOWN;
+        uint64_t lookups = totals.hits + totals.misses;
+        cout << "hits: " << totals.hits << endl
+             << "misses: " << totals.misses << endl
+             << "hit rate: " << (lookups ? 100 * totals.hits / lookups : 0) << "%" << endl
+             << "stores: " << totals.stores << endl
+             << "evictions: " << totals.evictions << endl
+             << "entries: " << entries << endl
+             << "size: " << (bytes >> 20) << " MiB" << endl
+             << "temporary files: " << temporaries << " (" << (temporary_bytes >> 20) << " MiB)"
+             << endl;
+        return 0;
 }
 
 int main(int argc, char **argv) {
+        if (argc > 1 && argv[1] == "compile-spec"s)
+                return compile_spec(argc - 1, argv + 1);
+        if (argc > 1 && argv[1] == "cache-stats"s)
+                return cache_stats(argc - 1, argv + 1);
+
         cxxopts::Options options("sa4u", "static analysis for UAVs");
         // clang-format off
         options.add_options()
@@ -1461,11 +1945,81 @@ int main(int argc, char **argv) {
            cxxopts::value<string>())
           ("m,message-definition",
            "path to XML file containing the message spec: Supported specs are "
-           "MavLink and LMCP",
+           "MavLink and LMCP. May be repeated, e.g. for several dialects; "
+           "included files are loaded too",
+           cxxopts::value<vector<string>>())
+          ("compiled-spec",
+           "path to the message spec compiled by sa4u compile-spec; the XML "
+           "is parsed instead if it changed since",
            cxxopts::value<string>())
           ("p,prior-types",
            "path to JSON file describing previously known types",
            cxxopts::value<string>())
+          ("q,query",
+           "explain the types stored to a single variable, e.g. "
+           "AP_GPS::state::location, instead of checking the whole program; "
+           "needs --load-summaries, so that only the translation units "
+           "missing from the store are parsed",
+           cxxopts::value<string>())
+          ("context-depth",
+           "analyze calls at least this deep in a single joined context per "
+           "function",
+           cxxopts::value<int>())
+          ("context-budget",
+           "analyze at most this many calling contexts per function; further "
+           "calls are joined into one context",
+           cxxopts::value<int>())
+          ("dump-variables",
+           "write the names of the member variables stored to, once each, "
+           "to this file",
+           cxxopts::value<string>())
+          ("diagnostics-format",
+           "write findings as text, jsonl or sarif",
+           cxxopts::value<string>()->default_value("text"))
+          ("diagnostics-output",
+           "write findings to this file instead of stdout; needed for jsonl "
+           "and sarif, since stdout also shows progress",
+           cxxopts::value<string>())
+          ("include",
+           "only analyze the files matching this glob, e.g. '*/libraries/*'; "
+           "may be repeated",
+           cxxopts::value<vector<string>>())
+          ("exclude",
+           "do not analyze the files matching this glob; may be repeated",
+           cxxopts::value<vector<string>>())
+          ("save-summaries",
+           "write the function summaries to this file, to be loaded by a "
+           "later run",
+           cxxopts::value<string>())
+          ("load-summaries",
+           "load the summaries of the translation units that this file has "
+           "instead of parsing them; they must have been written for the "
+           "same message definitions",
+           cxxopts::value<string>())
+          ("cache-dir",
+           "take the summaries of translation units from this cache "
+           "directory when their files and the analysis inputs are "
+           "unchanged, and add the ones parsed; the directory may be shared",
+           cxxopts::value<string>())
+          ("cache-max-size",
+           "after the run, evict the least recently used cache entries until "
+           "the cache takes at most this many MiB",
+           cxxopts::value<uint64_t>())
+          ("changed-since",
+           "only parse the translation units that depend on files changed "
+           "since this git revision, taking the rest from --load-summaries, "
+           "and report how the findings changed",
+           cxxopts::value<string>())
+          ("dry-run",
+           "report how many unique translation units would be analyzed, then "
+           "exit")
+          ("prescan",
+           "lexically scan the translation units first and only parse the "
+           "ones that mention a message type, an accessor or a prior-typed "
+           "variable, and their callees and callers")
+          ("infer-units",
+           "infer the units of variables from the program and report "
+           "conflicting units")
           ("h,help", 
            "print this message and exit")
           ("v,verbose",
@@ -1478,11 +2032,13 @@ int main(int argc, char **argv) {
                 exit(0);
         }
 
-        string compilation_database_path, message_def_path, prior_types_path;
+        string compilation_database_path, prior_types_path;
+        vector<string> message_def_paths;
         try {
                 compilation_database_path =
                     result["compilation-database"].as<string>();
-                message_def_path = result["message-definition"].as<string>();
+                message_def_paths =
+                    result["message-definition"].as<vector<string>>();
                 prior_types_path = result["prior-types"].as<string>();
                 if (result["verbose"].as<bool>())
                         spdlog::set_level(spdlog::level::trace);
@@ -1490,51 +2046,60 @@ int main(int argc, char **argv) {
                 cerr << options.help() << endl;
                 exit(1);
         }
-
-        // (0) load data sources
-        pugi::xml_document doc;
-        ifstream xml_in(message_def_path);
-        if (!doc.load(xml_in)) {
-                spdlog::critical("cannot load message XML");
-                exit(1);
-        }
-        xml_in.close();
-
-        int num_units = 0;
-        map<string, string> type_to_semantic;
-        map<string, int> unitname_to_id;
-        map<string, map<string, int>> type_to_field_to_unit;
-        map<string, TypeInfo> function_to_return_type;
-
-        switch (detect_definition_type(doc)) {
-        case MAVLINK:
-                type_to_semantic = get_types_to_frame_field(doc);
-                type_to_field_to_unit =
-                    get_type_to_field_to_unit(doc, unitname_to_id, num_units);
-                break;
-        case LMCP:
-                function_to_return_type = get_units_of_functions(doc, unitname_to_id, num_units);
-                break;
-        case UNKNOWN:
-        default:
-                spdlog::critical("message not in a supported spec");
+        // a query only reads the summaries, which parsing every TU for would
+        // take as long as checking the whole program.
+        if (result.count("query") && !result.count("load-summaries")) {
+                spdlog::critical("--query needs --load-summaries");
                 exit(1);
-                break;
         }
 
-        ifstream json_in(prior_types_path);
-        if (!json_in) {
-                spdlog::critical("cannot load prior JSON");
+        // (0) load data sources
+        MessageSpec spec;
+        bool have_spec = false;
+        if (result.count("compiled-spec")) {
+                string compiled_spec_path = result["compiled-spec"].as<string>();
+                string error = read_compiled_spec(compiled_spec_path,
+                                                  message_def_paths, spec);
+                if (error.empty())
+                        have_spec = true;
+                else
+                        spdlog::warn("not using compiled spec {}: {}",
+                                     compiled_spec_path, error);
+        }
+        if (!have_spec)
+                spec = load_message_spec(message_def_paths);
+
+        int num_units = spec.num_units;
+        map<string, string> &type_to_semantic = spec.type_to_semantic;
+        map<string, int> &unitname_to_id = spec.unitname_to_id;
+        map<string, map<string, int>> &type_to_field_to_unit = spec.type_to_field_to_unit;
+        map<string, TypeInfo> &function_to_return_type = spec.function_to_return_type;
+
+        // Probed for every call expression, so compiled into a lock-free
+        // table.
+        const PerfectHashTable<TypeInfo> return_unit_table(function_to_return_type);
+
+        // The priors can be hundreds of MB, so they are streamed into the
+        // table as they are parsed.
+        map<string, TypeInfo> prior_var_to_typeinfo;
+        string prior_error = read_variable_info(
+            prior_types_path, [&](VariableEntry &&ve) {
+                    add_prior_type(prior_var_to_typeinfo, ve, unitname_to_id,
+                                   num_units);
+            });
+        if (!prior_error.empty()) {
+                spdlog::critical("cannot load prior JSON {}: {}",
+                                 prior_types_path, prior_error);
                 exit(1);
         }
-        vector<VariableEntry> vars = read_variable_info(json_in);
-        json_in.close();
-        map<string, TypeInfo> prior_var_to_typeinfo =
-            vars_to_typeinfo(vars, unitname_to_id, num_units);
 
         // Maps the ID of a unit (e.g. 0) to its name (e.g. centimeter). 
         map<int, string> id_to_unitname = invert_map(unitname_to_id);
 
+        // Maps the ID of a unit to its dimension, parsed once for all fields.
+        vector<optional<DimensionId>> unit_dimensions =
+            get_unit_dimensions(unitname_to_id, num_units);
+
         // (1) load database
         CXCompilationDatabase_Error err;
         CXCompilationDatabase cdatabase =
@@ -1552,44 +2117,424 @@ int main(int argc, char **argv) {
         // (3) search each file in the compilation commands for mavlink messages
         unsigned num_cmds = clang_CompileCommands_getSize(cmds);
         vector<map<string, FunctionSummary>> fn_summaries(num_cmds);
+        vector<vector<Diagnostic>> parse_diagnostics(num_cmds);
         unordered_map<string, set<unsigned>> name_to_tu;
         name_to_tu.reserve(num_cmds * 50);
 
-        set<string> interesting_writes;
-        for (const auto &entry : vars)
-                interesting_writes.insert(entry.variable_name);
-
+        const PathIndex prior_types(prior_var_to_typeinfo);
+
+        // the commands to parse
+        vector<string> include_globs, exclude_globs;
+        if (result.count("include"))
+                include_globs = result["include"].as<vector<string>>();
+        if (result.count("exclude"))
+                exclude_globs = result["exclude"].as<vector<string>>();
+        CommandSelection selection;
+        vector<unsigned> work =
+            select_commands(cmds, include_globs, exclude_globs, selection);
+        cout << "analyzing " << work.size() << " of " << num_cmds
+             << " compile commands (" << selection.excluded << " excluded, "
+             << selection.duplicates << " duplicates)" << endl;
+        if (result.count("prescan")) {
+                vector<string> identifiers;
+                if (get_prescan_identifiers(spec, prior_var_to_typeinfo, identifiers)) {
+                        vector<bool> selected = prescan_translation_units(
+                            get_prescan_units(cmds, work), identifiers,
+                            thread::hardware_concurrency());
+                        vector<unsigned> relevant;
+                        for (size_t k = 0; k < work.size(); k++)
+                                if (selected[k])
+                                        relevant.push_back(work[k]);
+                        cout << "prescan: parsing " << relevant.size() << " of "
+                             << work.size() << " translation units" << endl;
+                        work.swap(relevant);
+                } else {
+                        spdlog::warn("cannot prescan: a prior type pattern can "
+                                     "match any variable name");
+                }
+        }
         set<string> functions_with_intrinsic_variables;
         unordered_set<string> seen_definitions;
         seen_definitions.reserve(num_cmds * 50);
+        vector<string> unit_names = get_unit_names(id_to_unitname);
+        vector<unsigned> analyzed = work;
+        bool loaded_summaries = false;
+        if (result.count("load-summaries")) {
+                string store_path = result["load-summaries"].as<string>();
+                string error = load_summaries(store_path, cmds, unit_names, work,
+                                              fn_summaries, name_to_tu,
+                                              functions_with_intrinsic_variables,
+                                              parse_diagnostics, seen_definitions);
+                loaded_summaries = error.empty();
+                if (loaded_summaries)
+                        cout << "loaded the summaries of "
+                             << analyzed.size() - work.size() << " of "
+                             << analyzed.size() << " translation units" << endl;
+                else
+                        spdlog::warn("not using summaries {}: {}", store_path, error);
+        }
+
+        // the loaded TUs that depend on changed files; their stored
+        // summaries are the baseline the findings are compared against.
+        vector<unsigned> stale;
+        bool report_changes = result.count("changed-since");
+        if (report_changes) {
+                if (!result.count("load-summaries")) {
+                        spdlog::critical("--changed-since needs --load-summaries");
+                        exit(1);
+                }
+                string rev = result["changed-since"].as<string>();
+                unordered_set<string> changed_files;
+                string error = get_changed_files(compilation_database_path, rev,
+                                                 changed_files);
+                if (!error.empty()) {
+                        spdlog::critical("cannot find the files changed since {}: {}",
+                                         rev, error);
+                        exit(1);
+                }
+                vector<bool> to_parse(num_cmds, false);
+                for (unsigned i : work)
+                        to_parse[i] = true;
+                vector<unsigned> loaded;
+                for (unsigned i : analyzed)
+                        if (!to_parse[i])
+                                loaded.push_back(i);
+                vector<bool> dependent = find_dependent_units(
+                    get_prescan_units(cmds, loaded), changed_files,
+                    thread::hardware_concurrency());
+                for (size_t k = 0; k < loaded.size(); k++)
+                        if (dependent[k])
+                                stale.push_back(loaded[k]);
+                cout << changed_files.size() << " files changed since " << rev
+                     << "; " << stale.size() << " stored translation units depend on them"
+                     << endl;
+                work.insert(work.end(), stale.begin(), stale.end());
+                sort(work.begin(), work.end());
+        }
+        if (result.count("dry-run")) {
+                cout << work.size() << " unique translation units would be analyzed" << endl;
+                clang_CompileCommands_dispose(cmds);
+                clang_CompilationDatabase_dispose(cdatabase);
+                exit(0);
+        }
+
+        ContextLimits limits;
+        if (result.count("context-depth"))
+                limits.max_depth = result["context-depth"].as<int>();
+        if (result.count("context-budget"))
+                limits.budget = result["context-budget"].as<int>();
+
+        // solve the traces of the stored summaries first, so that only the
+        // contexts of the functions parsed again are solved after. The
+        // solved contexts are not stored, so this costs as much as solving
+        // the traces of a full run.
+        optional<TraceSolver> baseline;
+        if (report_changes && loaded_summaries && !result.count("query")) {
+                baseline.emplace(name_to_tu, fn_summaries, prior_types, num_units, limits);
+                for (const auto &fn : functions_with_intrinsic_variables)
+                        baseline->add_root(fn);
+                baseline->solve();
+        }
+        // the findings of parsing the stored TUs, so that only the ones
+        // parsing the stale TUs again adds or removes are reported.
+        unordered_set<string> stored_messages;
+        vector<Diagnostic> stale_diagnostics;
+        if (report_changes)
+                for (unsigned i : analyzed)
+                        for (const auto &d : parse_diagnostics[i])
+                                stored_messages.insert(d.message);
+        set<string> changed_fns;
+        for (unsigned i : stale) {
+                for (const auto &fn : fn_summaries[i]) {
+                        changed_fns.insert(fn.first);
+                        const auto &defined = name_to_tu.find(fn.first);
+                        if (defined != name_to_tu.end() && defined->second.erase(i) &&
+                            defined->second.empty())
+                                name_to_tu.erase(defined);
+                }
+                fn_summaries[i].clear();
+                for (auto &d : parse_diagnostics[i])
+                        stale_diagnostics.push_back(move(d));
+                parse_diagnostics[i].clear();
+        }
+        if (!stale.empty()) {
+                // claim the definitions again without the stale TUs, so that
+                // one they shared with a loaded TU is used from that TU, and
+                // the TUs parsed again do not summarize it a second time.
+                seen_definitions.clear();
+                for (unsigned i : analyzed) {
+                        for (const auto &fn : fn_summaries[i]) {
+                                bool claimed = false;
+                                for (const auto &usr : fn.second.usrs)
+                                        claimed |= seen_definitions.insert(usr).second;
+                                if (claimed)
+                                        name_to_tu[fn.first].insert(i);
+                        }
+                }
+                for (auto it = functions_with_intrinsic_variables.begin();
+                     it != functions_with_intrinsic_variables.end();) {
+                        if (name_to_tu.count(*it))
+                                it++;
+                        else
+                                it = functions_with_intrinsic_variables.erase(it);
+                }
+        }
 
         // initialize worker threads
         int file_no = 0;
         mutex lock, cout_lock;
         vector<thread> workers;
         unsigned num_workers = max(1u, thread::hardware_concurrency());
+        bool infer_units = result.count("infer-units");
+        DiagnosticsFormat diagnostics_format;
+        if (!DiagnosticsSink::parse_format(result["diagnostics-format"].as<string>(),
+                                           diagnostics_format)) {
+                spdlog::critical("unknown diagnostics format {}",
+                                 result["diagnostics-format"].as<string>());
+                exit(1);
+        }
+        string diagnostics_path = result.count("diagnostics-output")
+                                      ? result["diagnostics-output"].as<string>()
+                                      : "";
+        // progress is printed to stdout, so only text can share it
+        if (diagnostics_format != DIAGNOSTICS_TEXT && diagnostics_path.empty()) {
+                spdlog::critical("--diagnostics-format {} needs --diagnostics-output",
+                                 result["diagnostics-format"].as<string>());
+                exit(1);
+        }
+        DiagnosticsSink diagnostics(diagnostics_format, diagnostics_path, cout_lock);
+        if (!diagnostics.ok()) {
+                spdlog::critical("cannot write diagnostics to {}", diagnostics_path);
+                exit(1);
+        }
+        unique_ptr<AsyncLineWriter> variable_dump;
+        if (result.count("dump-variables")) {
+                string dump_path = result["dump-variables"].as<string>();
+                variable_dump = make_unique<AsyncLineWriter>(dump_path, true);
+                if (!variable_dump->ok()) {
+                        spdlog::critical("cannot write variables to {}", dump_path);
+                        exit(1);
+                }
+        }
+
+        // report what parsing the loaded TUs found, unless only the changes
+        // are reported.
+        if (!report_changes)
+                for (unsigned i : analyzed)
+                        for (const auto &d : parse_diagnostics[i])
+                                diagnostics.report(d);
+
+        // take the TUs to parse from the cache where possible
+        vector<unsigned> updated = work;
+        unique_ptr<SummaryCache> cache;
+        vector<string> cache_keys(num_cmds);
+        if (result.count("cache-dir")) {
+                string cache_dir = result["cache-dir"].as<string>();
+                Sha256::Digest context;
+                string error = get_cache_context(spec, prior_types_path, context);
+                if (error.empty()) {
+                        cache = make_unique<SummaryCache>(cache_dir, context);
+                        error = cache->error();
+                }
+                if (!error.empty()) {
+                        spdlog::warn("not using cache {}: {}", cache_dir, error);
+                        cache.reset();
+                }
+        }
+        if (cache) {
+                // unit inference and the variable dump need the TUs parsed.
+                bool use_entries = !infer_units && !variable_dump;
+                vector<optional<Sha256::Digest>> hashes = hash_translation_units(
+                    get_prescan_units(cmds, work), thread::hardware_concurrency());
+                vector<unsigned> misses;
+                for (size_t k = 0; k < work.size(); k++) {
+                        unsigned i = work[k];
+                        // an unreadable main file is left to libclang to report.
+                        if (!hashes[k]) {
+                                misses.push_back(i);
+                                continue;
+                        }
+                        cache_keys[i] = cache->key(
+                            get_command_key(clang_CompileCommands_getCommand(cmds, i)), hashes[k].value());
+                        unique_ptr<SummaryStore> entry;
+                        if (use_entries)
+                                entry = cache->lookup(cache_keys[i]);
+                        if (!entry || entry->unit_names() != unit_names) {
+                                misses.push_back(i);
+                                continue;
+                        }
+                        entry->load_translation_unit(0, i, fn_summaries, name_to_tu,
+                                                     functions_with_intrinsic_variables,
+                                                     seen_definitions);
+                        parse_diagnostics[i] = entry->diagnostics(0);
+                        if (!report_changes)
+                                for (const auto &d : parse_diagnostics[i])
+                                        diagnostics.report(d);
+                }
+                cout << "cache: parsing " << misses.size() << " of " << work.size()
+                     << " translation units" << endl;
+                work.swap(misses);
+        }
+
+        vector<UnitConstraints> unit_constraints(num_workers);
         for (unsigned i = 0u; i < num_workers; i++) {
                 workers.push_back(thread(
-                    do_work, cmds, i, num_workers, ref(interesting_writes),
+                    do_work, cmds, cref(work), i, num_workers,
                     ref(functions_with_intrinsic_variables),
                     ref(seen_definitions), ref(type_to_semantic),
                     ref(type_to_field_to_unit), ref(fn_summaries),
                     ref(name_to_tu), ref(lock), num_units, ref(file_no),
-                    ref(cout_lock), ref(prior_var_to_typeinfo), 
-                    ref(function_to_return_type), ref(id_to_unitname)));
+                    ref(cout_lock), cref(prior_types),
+                    cref(return_unit_table), ref(id_to_unitname),
+                    cref(unit_dimensions),
+                    infer_units ? &unit_constraints[i] : nullptr,
+                    variable_dump.get(),
+                    report_changes ? nullptr : &diagnostics,
+                    ref(parse_diagnostics), !cache));
         }
 
         // wait for completion
         for (auto &thread : workers)
                 thread.join();
 
+        if (report_changes) {
+                // compare by message, so that a finding another TU still
+                // reports, e.g. in a shared header, is not fixed.
+                unordered_set<string> messages;
+                for (unsigned i : analyzed)
+                        for (const auto &d : parse_diagnostics[i])
+                                messages.insert(d.message);
+                for (unsigned i : updated)
+                        for (const auto &d : parse_diagnostics[i])
+                                if (!stored_messages.count(d.message))
+                                        diagnostics.report(d);
+                for (auto &d : stale_diagnostics) {
+                        if (messages.count(d.message))
+                                continue;
+                        d.fixed = true;
+                        d.message = "FIXED " + d.message;
+                        diagnostics.report(d);
+                }
+        }
+        if (variable_dump)
+                variable_dump->close();
+
+        if (cache) {
+                // TUs without summaries, e.g. ones libclang could not build,
+                // are parsed again next time.
+                unsigned failures = 0;
+                for (unsigned i : work) {
+                        if (cache_keys[i].empty() || fn_summaries[i].empty())
+                                continue;
+                        string error = cache->insert(
+                            cache_keys[i],
+                            get_snapshot(cmds, {i}, unit_names, fn_summaries,
+                                         functions_with_intrinsic_variables, parse_diagnostics));
+                        if (!error.empty() && failures++ == 0)
+                                spdlog::warn("cannot add to cache: {}", error);
+                }
+                if (result.count("cache-max-size"))
+                        cache->evict(result["cache-max-size"].as<uint64_t>() << 20);
+                const CacheStatistics &counts = cache->counts();
+                cout << "cache: " << counts.hits << " hits, " << counts.misses
+                     << " misses, " << counts.stores << " stores, "
+                     << counts.evictions << " evictions" << endl;
+                string error = cache->flush();
+                if (!error.empty())
+                        spdlog::warn("cannot update cache statistics: {}", error);
+        }
+
+        if (result.count("save-summaries")) {
+                string store_path = result["save-summaries"].as<string>();
+                string error = write_summary_store(
+                    store_path,
+                    get_snapshot(cmds, analyzed, unit_names, fn_summaries,
+                                 functions_with_intrinsic_variables, parse_diagnostics));
+                if (!error.empty())
+                        spdlog::warn("cannot save summaries to {}: {}", store_path, error);
+        }
+
         clang_CompileCommands_dispose(cmds);
         clang_CompilationDatabase_dispose(cdatabase);
 
-        vector<vector<string>> traces = get_unconstrained_traces(
-            name_to_tu, fn_summaries, functions_with_intrinsic_variables,
-            prior_var_to_typeinfo, num_units);
-        
+        if (infer_units) {
+                UnitConstraints all_constraints;
+                for (const auto &constraints : unit_constraints)
+                        all_constraints.merge(constraints);
+                for (const auto &prior : prior_var_to_typeinfo) {
+                        if (prior.second.dimension && !PathIndex::is_pattern(prior.first))
+                                all_constraints.known(
+                                    all_constraints.variable(prior.first),
+                                    get_dimension(prior.second.dimension.value()));
+                }
+
+                InferenceResult inference = all_constraints.solve();
+                for (const auto &p : inference.inferred) {
+                        // skip the terms of parameters and return values.
+                        if (p.first.find('#') == string::npos)
+                                cout << "INFERRED: " << p.first << ": "
+                                     << p.second << endl;
+                }
+                for (const auto &conflict : inference.conflicts) {
+                        Diagnostic d;
+                        d.kind = DIAG_UNIT_CONFLICT;
+                        stringstream ss;
+                        string sep = "";
+                        for (const auto &var : conflict.variables) {
+                                ss << sep << var;
+                                sep = ", ";
+                        }
+                        d.variable = ss.str();
+                        ss << " have ";
+                        sep = "";
+                        for (const auto &dimension : conflict.dimensions) {
+                                ss << sep << dimension;
+                                sep = " vs ";
+                        }
+                        d.message = "UNIT CONFLICT: " + ss.str();
+                        diagnostics.report(d);
+                }
+        }
+
+        if (result.count("query")) {
+                string query = result["query"].as<string>();
+                vector<StoreExplanation> explanations =
+                    explain_variable(query, name_to_tu, fn_summaries, prior_types);
+                set<string> found_explanations;
+                for (const auto &explanation : explanations) {
+                        stringstream ss;
+                        print_trace(ss, explanation.trace);
+                        if (explanation.resolved)
+                                ss << ": " << format_units(explanation.type, id_to_unitname);
+                        else
+                                ss << ": unknown (parameter "
+                                   << explanation.type.source.front().param_no
+                                   << " of a function without callers)";
+                        if (explanation.contradicts_prior)
+                                ss << ", expected "
+                                   << format_units(*prior_types.find(query), id_to_unitname);
+                        if (found_explanations.insert(ss.str()).second)
+                                cout << "QUERY: " << ss.str() << endl;
+                }
+                if (explanations.empty())
+                        cout << "QUERY: no stores to " << query << endl;
+                diagnostics.close();
+                exit(0);
+        }
+
+        if (baseline) {
+                for (unsigned i : updated)
+                        for (const auto &fn : fn_summaries[i])
+                                changed_fns.insert(fn.first);
+                TraceDiff diff = baseline->update(changed_fns, functions_with_intrinsic_variables);
+                report_trace_diff(diff, diagnostics);
+        } else {
+                get_unconstrained_traces(name_to_tu, fn_summaries,
+                                         functions_with_intrinsic_variables,
+                                         prior_types, num_units, limits, diagnostics);
+        }
+        diagnostics.close();
+
         cout << "===DIAGNOSTICS===" << endl;
         cout << "functions with intrinsic variables: " << endl;
         for (const string &str : functions_with_intrinsic_variables) {
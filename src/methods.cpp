@@ -1,8 +1,42 @@
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "methods.hpp"
 #include "util.hpp"
 
 using namespace std;
 
+/*
+ * Identifies a resolved call within a translation unit: the method referenced
+ * and the declaration of the receiver's type.
+ */
+struct CalleeKey {
+    CXCursor method;
+    CXCursor receiver;
+    // Whether the call is dynamic: obj.Base::f() resolves differently than obj.f().
+    bool dynamic;
+
+    bool operator==(const CalleeKey &other) const {
+        return clang_equalCursors(method, other.method) && clang_equalCursors(receiver, other.receiver) &&
+               dynamic == other.dynamic;
+    }
+};
+
+struct CalleeKeyHash {
+    size_t operator()(const CalleeKey &k) const {
+        return (clang_hashCursor(k.method) * 31 + clang_hashCursor(k.receiver)) * 2 + k.dynamic;
+    }
+};
+
+// Caches resolved names within the translation unit that the thread is parsing.
+static thread_local unordered_map<CalleeKey, vector<string>, CalleeKeyHash> tu_fq_methods;
+
+// Maps the USR of a virtual method to the names of the class methods it
+// overrides. Shared across translation units since USRs are stable.
+static unordered_map<string, vector<string>> virtual_fq_methods;
+static mutex virtual_fq_methods_lock;
+
 /*
  * Returns the type of t without pointer and const qualifiers.
  */
@@ -35,41 +69,79 @@ static string get_fq_non_virtual_method(CXCursor cursor) {
 }
 
 /*
- * Returns the fully qualified name of the method called at cursor.
+ * Returns the names of the class methods that the virtual method ref
+ * overrides, one per base class that declares it.
+ */
+static vector<string> get_overridden_methods(CXCursor cursor, CXCursor ref) {
+    string usr = get_USR(ref);
+    {
+        lock_guard<mutex> guard(virtual_fq_methods_lock);
+        const auto &it = virtual_fq_methods.find(usr);
+        if (it != virtual_fq_methods.end()) {
+            return it->second;
+        }
+    }
+
+    vector<string> result;
+    CXCursor *overriden_methods = nullptr;
+    unsigned num_overriden = 0;
+    clang_getOverriddenCursors(ref, &overriden_methods, &num_overriden);
+
+    CXString cursor_spelling = clang_getCursorSpelling(cursor);
+    string method_name = clang_getCString(cursor_spelling);
+    clang_disposeString(cursor_spelling);
+
+    // With multiple inheritance, the method overrides one method per base.
+    for (unsigned i = 0; i < num_overriden; i++) {
+        CXCursor defining_class = clang_getCursorSemanticParent(overriden_methods[i]);
+
+        CXString defining_class_spelling = clang_getTypeSpelling(clang_getCursorType(defining_class));
+        string defining_class_str = clang_getCString(defining_class_spelling);
+        clang_disposeString(defining_class_spelling);
+
+        result.push_back(defining_class_str + "::" + method_name);
+    }
+    clang_disposeOverriddenCursors(overriden_methods);
+
+    lock_guard<mutex> guard(virtual_fq_methods_lock);
+    virtual_fq_methods.emplace(usr, result);
+    return result;
+}
+
+/*
+ * Returns the fully qualified names of the methods called at cursor.
  * Pre:
  *   cursor is a CXCursor_CallExpr.
  */
-string get_fq_method(CXCursor cursor) {
-    string fq_method = "";
-    if (clang_Cursor_isDynamicCall(cursor)) {
-        CXCursor ref = clang_getCursorReferenced(cursor);
-        CXCursor *overriden_methods = nullptr;
-        unsigned num_overriden = 0;
-        clang_getOverriddenCursors(ref, &overriden_methods, &num_overriden);
-
-        // This happens when there is a call to a virtual method and the receiver is the base class.
-        if (num_overriden == 0) {
-            fq_method = get_fq_non_virtual_method(cursor);
-        } else {
-            // Use the first parent class as the class.
-            // TODO: handle MULTIPLE inheritance correctly.
-            CXCursor overriden_method = overriden_methods[0];
-            CXCursor defining_class = clang_getCursorSemanticParent(overriden_method);
-            
-            CXString defining_class_spelling = clang_getTypeSpelling(clang_getCursorType(defining_class));
-            string defining_class_str = clang_getCString(defining_class_spelling);
-            clang_disposeString(defining_class_spelling);
-
-            CXString cursor_spelling = clang_getCursorSpelling(cursor);
-            string method_name = clang_getCString(cursor_spelling);
-            clang_disposeString(cursor_spelling);
-
-            fq_method = defining_class_str + "::" + method_name;
-        }
+const vector<string> &get_fq_methods(CXCursor cursor) {
+    CXCursor ref = clang_getCursorReferenced(cursor);
+    CXType receiver = get_plain_type(clang_getCanonicalType(clang_Cursor_getReceiverType(cursor)));
+    bool dynamic = clang_Cursor_isDynamicCall(cursor);
+    CalleeKey key = {ref, clang_getTypeDeclaration(receiver), dynamic};
+    // Calls through function pointers have no referenced declaration to key on.
+    if (clang_Cursor_isNull(ref)) {
+        static thread_local vector<string> uncached;
+        uncached = {get_fq_non_virtual_method(cursor)};
+        return uncached;
+    }
+
+    const auto &it = tu_fq_methods.find(key);
+    if (it != tu_fq_methods.end()) {
+        return it->second;
+    }
 
-        clang_disposeOverriddenCursors(overriden_methods);
-    } else {
-        fq_method = get_fq_non_virtual_method(cursor);
+    vector<string> fq_methods;
+    // No overridden methods happens when there is a call to a virtual method and the receiver is
+    // the base class, which is then the class.
+    if (dynamic) {
+        fq_methods = get_overridden_methods(cursor, ref);
     }
-    return fq_method;
-}
\ No newline at end of file
+    if (fq_methods.empty()) {
+        fq_methods.push_back(get_fq_non_virtual_method(cursor));
+    }
+    return tu_fq_methods.emplace(key, fq_methods).first->second;
+}
+
+void reset_fq_method_cache() {
+    tu_fq_methods.clear();
+}
@@ -1,14 +1,23 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <clang-c/Index.h>
 }
 
 /*
- * Returns the fully qualified name of the method called at cursor.
+ * Returns the fully qualified names of the methods called at cursor. A dynamic
+ * call to a method overriding methods of several bases has one name per base.
+ * The result is valid until reset_fq_method_cache is called.
  * Pre:
  *   cursor is a CXCursor_CallExpr.
  */
-std::string get_fq_method(CXCursor cursor);
\ No newline at end of file
+const std::vector<std::string> &get_fq_methods(CXCursor cursor);
+
+/*
+ * Forgets the names resolved by get_fq_methods on the calling thread.
+ * Must be called before the thread parses another translation unit.
+ */
+void reset_fq_method_cache();
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "path.hpp"
+
+// owns the interned components; a deque never moves its elements.
+static deque<string> components;
+static unordered_map<string_view, ComponentId> component_ids;
+static shared_mutex components_lock;
+
+ComponentId find_component(string_view component) {
+        shared_lock<shared_mutex> guard(components_lock);
+        const auto &it = component_ids.find(component);
+        return it == component_ids.end() ? -1 : it->second;
+}
+
+ComponentId intern_component(string_view component) {
+        ComponentId id = find_component(component);
+        if (id != -1)
+                return id;
+        unique_lock<shared_mutex> guard(components_lock);
+        const auto &it = component_ids.find(component);
+        if (it != component_ids.end())
+                return it->second;
+        id = components.size();
+        components.emplace_back(component);
+        component_ids.emplace(components.back(), id);
+        return id;
+}
+
+string_view component_name(ComponentId id) {
+        shared_lock<shared_mutex> guard(components_lock);
+        return components[id];
+}
+
+PathBuilder &PathBuilder::operator=(const PathBuilder &other) {
+        if (this == &other)
+                return *this;
+        count = other.count;
+        if (count <= INLINE_COMPONENTS) {
+                copy(other.components, other.components + count, components);
+                spilled.clear();
+        } else {
+                spilled = other.spilled;
+        }
+        return *this;
+}
+
+void PathBuilder::push_back(ComponentId id) {
+        if (count < INLINE_COMPONENTS) {
+                components[count++] = id;
+                return;
+        }
+        if (count == INLINE_COMPONENTS)
+                spilled.assign(components, components + count);
+        spilled.push_back(id);
+        count++;
+}
+
+void PathBuilder::append(const PathBuilder &other) {
+        for (size_t i = 0; i < other.size(); i++)
+                push_back(other[i]);
+}
+
+void PathBuilder::truncate(size_t size) {
+        if (size >= count)
+                return;
+        if (count > INLINE_COMPONENTS) {
+                spilled.resize(size);
+                if (size <= INLINE_COMPONENTS)
+                        copy(spilled.begin(), spilled.end(), components);
+        }
+        count = size;
+}
+
+void PathBuilder::reverse(size_t start) {
+        ComponentId *begin = count <= INLINE_COMPONENTS ? components : spilled.data();
+        if (start < count)
+                std::reverse(begin + start, begin + count);
+}
+
+bool PathBuilder::starts_with(const PathBuilder &prefix) const {
+        return prefix.size() <= count && equal(prefix.data(), prefix.data() + prefix.size(), data());
+}
+
+bool PathBuilder::operator==(const PathBuilder &other) const {
+        return count == other.count && equal(data(), data() + count, other.data());
+}
+
+string PathBuilder::str() const {
+        size_t length = count == 0 ? 0 : 2 * (count - 1);
+        for (size_t i = 0; i < count; i++)
+                length += component_name(data()[i]).size();
+        string result;
+        result.reserve(length);
+        for (size_t i = 0; i < count; i++) {
+                if (i)
+                        result += "::";
+                result += component_name(data()[i]);
+        }
+        return result;
+}
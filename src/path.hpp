@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Identifies an interned path component, e.g. "state" in AP_GPS::state.
+typedef int ComponentId;
+
+// Returns the ID of component, interning it if it is new. Thread-safe.
+ComponentId intern_component(string_view component);
+
+// Returns the ID of component, or -1 if it was never interned. Thread-safe.
+ComponentId find_component(string_view component);
+
+// Returns the spelling of an interned component. The view stays valid.
+string_view component_name(ComponentId id);
+
+/**
+ * A scoped name (e.g. AP_GPS::state::location) as a sequence of interned
+ * component IDs.
+ *
+ * Short paths are kept in an inline buffer, so building one from cursor
+ * spellings does not allocate once its components are interned, and
+ * comparing paths compares integers. str() materializes the "::"-separated
+ * name for maps and reports that need it.
+ */
+class PathBuilder {
+      public:
+        PathBuilder() = default;
+        PathBuilder(const PathBuilder &other) { *this = other; }
+        PathBuilder &operator=(const PathBuilder &other);
+
+        void push_back(ComponentId id);
+
+        // Interns component and appends it.
+        void push_back(string_view component) { push_back(intern_component(component)); }
+
+        void append(const PathBuilder &other);
+
+        // Drops the components after the first size.
+        void truncate(size_t size);
+
+        // Reverses the components from index start on.
+        void reverse(size_t start = 0);
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        ComponentId operator[](size_t i) const { return data()[i]; }
+
+        bool starts_with(const PathBuilder &prefix) const;
+        bool operator==(const PathBuilder &other) const;
+
+        // Returns the components joined by "::".
+        string str() const;
+
+      private:
+        static const size_t INLINE_COMPONENTS = 8;
+
+        const ComponentId *data() const { return count <= INLINE_COMPONENTS ? components : spilled.data(); }
+
+        ComponentId components[INLINE_COMPONENTS];
+
+        // holds every component once there are more than INLINE_COMPONENTS
+        vector<ComponentId> spilled;
+
+        size_t count = 0;
+};
@@ -0,0 +1,200 @@
+#include <algorithm>
+
+#include "path_index.hpp"
+#include "util.hpp"
+
+PathIndex::PathIndex() {
+        add_node();
+}
+
+PathIndex::PathIndex(const map<string, TypeInfo> &entries) : PathIndex() {
+        for (const auto &entry : entries)
+                insert(entry.first, entry.second);
+}
+
+bool PathIndex::is_pattern(string_view path) {
+        return path.find_first_of("*?") != string_view::npos;
+}
+
+PathIndex::Glob::Glob(string_view pattern, Node target) : pattern(pattern), target(target) {
+        size_t first = pattern.find_first_of("*?");
+        size_t last = pattern.find_last_of("*?");
+        prefix = pattern.substr(0, first);
+        suffix = pattern.substr(last + 1);
+        simple = first == last && pattern[first] == '*';
+}
+
+bool PathIndex::Glob::matches(string_view component) const {
+        if (component.size() < prefix.size() + suffix.size() ||
+            component.substr(0, prefix.size()) != prefix ||
+            component.substr(component.size() - suffix.size()) != suffix)
+                return false;
+        return simple || glob_match(pattern, component);
+}
+
+PathIndex::Specificity PathIndex::specificity(string_view path) {
+        int num_deep = 0, num_exact = 0, num_literals = 0, num_wildcards = 0;
+        size_t start = 0;
+        while (true) {
+                size_t end = path.find("::", start);
+                string_view component = path.substr(start, end == string_view::npos ? end : end - start);
+                if (component == "**")
+                        num_deep++;
+                else if (is_pattern(component)) {
+                        int wildcards = count_if(component.begin(), component.end(),
+                                                 [](char c) { return c == '*' || c == '?'; });
+                        num_wildcards += wildcards;
+                        num_literals += component.size() - wildcards;
+                } else
+                        num_exact++;
+                if (end == string_view::npos)
+                        break;
+                start = end + 2;
+        }
+        return {num_deep, -num_exact, -num_literals, num_wildcards, string(path)};
+}
+
+PathIndex::Node PathIndex::add_node() {
+        Node node = values.size();
+        values.emplace_back();
+        ranks.emplace_back();
+        globs.emplace_back();
+        deep.push_back(NONE);
+        loops.push_back(false);
+        return node;
+}
+
+void PathIndex::insert(string_view path, const TypeInfo &type) {
+        Node node = 0;
+        size_t start = 0;
+        while (true) {
+                size_t end = path.find("::", start);
+                string_view component = path.substr(start, end == string_view::npos ? end : end - start);
+                if (component == "**") {
+                        if (deep[node] == NONE) {
+                                Node next = add_node();
+                                deep[node] = next;
+                                loops[next] = true;
+                        }
+                        node = deep[node];
+                        has_patterns = true;
+                } else if (is_pattern(component)) {
+                        auto it = find_if(globs[node].begin(), globs[node].end(),
+                                          [component](const Glob &g) { return g.pattern == component; });
+                        if (it != globs[node].end()) {
+                                node = it->target;
+                        } else {
+                                Node next = add_node();
+                                globs[node].emplace_back(component_name(intern_component(component)), next);
+                                node = next;
+                        }
+                        has_patterns = true;
+                } else {
+                        ComponentId id = intern_component(component);
+                        const auto &it = edges.find(edge(node, id));
+                        if (it != edges.end()) {
+                                node = it->second;
+                        } else {
+                                Node next = add_node();
+                                edges.emplace(edge(node, id), next);
+                                node = next;
+                        }
+                }
+                if (end == string_view::npos)
+                        break;
+                start = end + 2;
+        }
+
+        if (!values[node]) {
+                values[node] = type;
+                ranks[node] = specificity(path);
+        }
+}
+
+void PathIndex::add_state(vector<Node> &nodes, Node node) const {
+        while (node != NONE && std::find(nodes.begin(), nodes.end(), node) == nodes.end()) {
+                nodes.push_back(node);
+                node = deep[node];
+        }
+}
+
+PathIndex::Probe PathIndex::root() const {
+        Probe probe = {0, {}};
+        if (has_patterns)
+                add_state(probe.patterns, deep[0]);
+        return probe;
+}
+
+PathIndex::Node PathIndex::exact_step(Node node, ComponentId component) const {
+        if (component == -1)
+                return NONE;
+        const auto &it = edges.find(edge(node, component));
+        return it == edges.end() ? NONE : it->second;
+}
+
+PathIndex::Probe PathIndex::step(const Probe &probe, string_view component) const {
+        return advance(probe, find_component(component), component);
+}
+
+PathIndex::Probe PathIndex::step(const Probe &probe, ComponentId component) const {
+        // only glob edges need the spelling
+        return advance(probe, component, has_patterns ? component_name(component) : string_view());
+}
+
+void PathIndex::add_glob_states(vector<Node> &nodes, Node node, string_view component) const {
+        for (const auto &g : globs[node])
+                if (g.matches(component))
+                        add_state(nodes, g.target);
+}
+
+PathIndex::Probe PathIndex::advance(const Probe &probe, ComponentId id, string_view component) const {
+        Probe next = {NONE, {}};
+        if (probe.exact != NONE) {
+                next.exact = exact_step(probe.exact, id);
+                if (has_patterns) {
+                        add_glob_states(next.patterns, probe.exact, component);
+                        if (next.exact != NONE)
+                                add_state(next.patterns, deep[next.exact]);
+                }
+        }
+        for (Node node : probe.patterns) {
+                add_state(next.patterns, exact_step(node, id));
+                add_glob_states(next.patterns, node, component);
+                if (loops[node])
+                        add_state(next.patterns, node);
+        }
+        return next;
+}
+
+PathIndex::Probe PathIndex::step_path(Probe probe, string_view path) const {
+        size_t start = 0;
+        while (!probe.rejected()) {
+                size_t end = path.find("::", start);
+                probe = step(probe, path.substr(start, end == string_view::npos ? end : end - start));
+                if (end == string_view::npos)
+                        break;
+                start = end + 2;
+        }
+        return probe;
+}
+
+PathIndex::Probe PathIndex::step_path(Probe probe, const PathBuilder &path) const {
+        for (size_t i = 0; i < path.size() && !probe.rejected(); i++)
+                probe = step(probe, path[i]);
+        return probe;
+}
+
+const TypeInfo *PathIndex::value(const Probe &probe) const {
+        if (probe.exact != NONE && values[probe.exact])
+                return &values[probe.exact].value();
+
+        Node best = NONE;
+        for (Node node : probe.patterns)
+                if (values[node] && (best == NONE || ranks[node] < ranks[best]))
+                        best = node;
+        return best == NONE ? nullptr : &values[best].value();
+}
+
+const TypeInfo *PathIndex::find(string_view path) const {
+        return value(step_path(root(), path));
+}
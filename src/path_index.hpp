@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+#include "path.hpp"
+
+using namespace std;
+
+/**
+ * Relates fully scoped variable paths (e.g. AP_GPS::state::location) to
+ * their types.
+ *
+ * Paths are stored in a trie over their "::"-separated components, and each
+ * component is interned (see path.hpp), so a path can be probed one
+ * component ID at a time while it is being built. A probe is rejected at the first component that
+ * no stored path continues with, without building the rest of the path.
+ *
+ * Paths may also be patterns. A component containing * or ? is a glob
+ * matched against one component (e.g. AP_*::state::*_cm), and a ** component
+ * matches any number of components (e.g. **::loc::alt). Patterns are
+ * compiled into the same trie, which then acts as an automaton: a probe
+ * tracks the set of nodes it is in, so all patterns are matched in one pass
+ * over the path. Globs are compiled to their literal prefix and suffix, so
+ * most components are rejected, and a glob with one * is matched, without
+ * running the general matcher.
+ *
+ * An exact path takes precedence over patterns. Among patterns the most
+ * specific wins, whatever order they were inserted in: the one with the
+ * fewest ** components, then the most exact components, then the most
+ * literal characters in its globs, then the fewest wildcard characters,
+ * then the first in ASCII order. E.g. AP_*::alt wins over *::alt.
+ *
+ * The index is filled before the worker threads start and only read
+ * afterwards, so probes need no locking.
+ */
+class PathIndex {
+      public:
+        // Identifies a prefix of one or more stored paths.
+        typedef int Node;
+
+        // The node of a prefix that no stored path has.
+        static constexpr Node NONE = -1;
+
+        // The state of a probe after some components.
+        struct Probe {
+                // the node reached by exact components only
+                Node exact;
+
+                // the nodes reached through patterns
+                vector<Node> patterns;
+
+                // Returns if no stored path or pattern has the probed prefix.
+                bool rejected() const { return exact == NONE && patterns.empty(); }
+        };
+
+        PathIndex();
+
+        explicit PathIndex(const map<string, TypeInfo> &entries);
+
+        // Relates path, which may be a pattern, to type.
+        void insert(string_view path, const TypeInfo &type);
+
+        // Returns the probe of the empty prefix.
+        Probe root() const;
+
+        // Returns the probe after appending component.
+        Probe step(const Probe &probe, string_view component) const;
+        Probe step(const Probe &probe, ComponentId component) const;
+
+        // Returns the probe after appending each component of path.
+        Probe step_path(Probe probe, string_view path) const;
+        Probe step_path(Probe probe, const PathBuilder &path) const;
+
+        // Returns the type of the probed path, or nullptr.
+        const TypeInfo *value(const Probe &probe) const;
+
+        // Returns the type of path, or nullptr.
+        const TypeInfo *find(string_view path) const;
+
+        // Returns if path is a pattern rather than an exact path.
+        static bool is_pattern(string_view path);
+
+      private:
+        // Returns a new node.
+        Node add_node();
+
+        // Adds node to nodes if it is new, along with the nodes its ** edge
+        // reaches without consuming a component.
+        void add_state(vector<Node> &nodes, Node node) const;
+
+        // Returns the node of the exact edge leaving node for component.
+        Node exact_step(Node node, ComponentId component) const;
+
+        // Returns the probe after appending component, whose ID is -1 if it
+        // was never interned.
+        Probe advance(const Probe &probe, ComponentId id, string_view component) const;
+
+        // Adds the targets of the glob edges leaving node that match
+        // component to nodes.
+        void add_glob_states(vector<Node> &nodes, Node node, string_view component) const;
+
+        // Returns the key of the edge leaving node for component.
+        static uint64_t edge(Node node, ComponentId component) {
+                return (static_cast<uint64_t>(node) << 32) | static_cast<uint32_t>(component);
+        }
+
+        // maps (node, component) edges to their target nodes
+        unordered_map<uint64_t, Node> edges;
+
+        // A glob edge. The views are into the interned pattern, so they stay
+        // valid.
+        struct Glob {
+                string_view pattern;
+
+                // the characters before the first and after the last wildcard
+                string_view prefix;
+                string_view suffix;
+
+                // if the only wildcard is one *, so that the prefix and suffix
+                // decide a match
+                bool simple;
+
+                Node target;
+
+                explicit Glob(string_view pattern, Node target);
+
+                bool matches(string_view component) const;
+        };
+
+        // the glob edges leaving each node
+        vector<vector<Glob>> globs;
+
+        // the target of the ** edge leaving each node, or NONE
+        vector<Node> deep;
+
+        // true for the targets of ** edges, which consume any component
+        vector<bool> loops;
+
+        // How specific a pattern is: the number of ** components, minus the
+        // number of exact components, minus the number of literal characters
+        // in globs, the number of wildcard characters, and the pattern. Lower
+        // is more specific.
+        typedef tuple<int, int, int, int, string> Specificity;
+
+        static Specificity specificity(string_view path);
+
+        // the types of the paths ending at each node, and how specific they
+        // are
+        vector<optional<TypeInfo>> values;
+        vector<Specificity> ranks;
+
+        bool has_patterns = false;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util.hpp"
+
+using namespace std;
+
+/**
+ * An immutable string-keyed table that finds each key with a single probe.
+ *
+ * The table is built with hash-and-displace: keys are hashed into buckets,
+ * and each bucket, largest first, is assigned the first seed that sends all
+ * of its keys to free slots. A lookup hashes the key twice, once for its
+ * bucket and once with the bucket's seed, and compares a single slot.
+ * Keys that differ in length or common prefix from every stored key are
+ * rejected before hashing.
+ *
+ * The table is never modified after it is built, so it can be read by any
+ * number of threads without locking.
+ */
+template <typename V> class PerfectHashTable {
+      public:
+        PerfectHashTable() = default;
+
+        explicit PerfectHashTable(const map<string, V> &entries) {
+                if (entries.empty())
+                        return;
+
+                prefix = entries.begin()->first;
+                for (const auto &entry : entries) {
+                        const string &key = entry.first;
+                        size_t common = 0;
+                        while (common < prefix.size() && common < key.size() &&
+                               prefix[common] == key[common])
+                                common++;
+                        prefix.resize(common);
+                        if (key.size() >= lengths.size())
+                                lengths.resize(key.size() + 1, false);
+                        lengths[key.size()] = true;
+                }
+
+                // a load factor of 0.8 keeps seed searches short.
+                size_t num_slots = entries.size() + entries.size() / 4 + 1;
+                while (!build(entries, num_slots))
+                        num_slots += num_slots / 4 + 1;
+        }
+
+        // Returns the value of key, or nullptr if it is not in the table.
+        const V *find(const string &key) const {
+                if (slots.empty() || key.size() >= lengths.size() ||
+                    !lengths[key.size()] ||
+                    key.compare(0, prefix.size(), prefix) != 0)
+                        return nullptr;
+                uint64_t seed = seeds[mix(fnv1a(key.data(), key.size())) % seeds.size()];
+                const auto &slot = slots[mix(fnv1a(key.data(), key.size(), seed)) % slots.size()];
+                if (!slot || slot->first != key)
+                        return nullptr;
+                return &slot->second;
+        }
+
+      private:
+        // Spreads the high bits of h into the low bits used for indexing.
+        static uint64_t mix(uint64_t h) {
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdULL;
+                h ^= h >> 33;
+                return h;
+        }
+
+        // Tries to place entries into num_slots slots.
+        bool build(const map<string, V> &entries, size_t num_slots) {
+                // the number of seeds to try per bucket before growing the table.
+                const uint64_t max_seed = 1 << 16;
+
+                size_t num_buckets = entries.size() / 4 + 1;
+                vector<vector<const pair<const string, V> *>> buckets(num_buckets);
+                for (const auto &entry : entries)
+                        buckets[mix(fnv1a(entry.first.data(), entry.first.size())) % num_buckets]
+                            .push_back(&entry);
+
+                vector<size_t> order(num_buckets);
+                for (size_t i = 0; i < num_buckets; i++)
+                        order[i] = i;
+                sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                        return buckets[a].size() > buckets[b].size();
+                });
+
+                slots.assign(num_slots, nullopt);
+                seeds.assign(num_buckets, 0);
+                vector<size_t> placed;
+                for (size_t b : order) {
+                        if (buckets[b].empty())
+                                break;
+                        uint64_t seed = 1;
+                        for (; seed < max_seed; seed++) {
+                                placed.clear();
+                                for (const auto *entry : buckets[b]) {
+                                        size_t slot = mix(fnv1a(entry->first.data(), entry->first.size(), seed)) % num_slots;
+                                        if (slots[slot] || find_slot(placed, slot))
+                                                break;
+                                        placed.push_back(slot);
+                                }
+                                if (placed.size() == buckets[b].size())
+                                        break;
+                        }
+                        if (seed == max_seed)
+                                return false;
+
+                        seeds[b] = seed;
+                        for (size_t i = 0; i < placed.size(); i++)
+                                slots[placed[i]] = *buckets[b][i];
+                }
+                return true;
+        }
+
+        static bool find_slot(const vector<size_t> &placed, size_t slot) {
+                return std::find(placed.begin(), placed.end(), slot) != placed.end();
+        }
+
+        // the longest prefix shared by every key
+        string prefix;
+
+        // lengths[n] is true if some key has length n
+        vector<bool> lengths;
+
+        // maps each bucket to the seed that places its keys
+        vector<uint64_t> seeds;
+
+        vector<optional<pair<string, V>>> slots;
+};
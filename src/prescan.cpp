@@ -0,0 +1,391 @@
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "prescan.hpp"
+#include "util.hpp"
+
+// What scanning one file found.
+struct FileScan {
+        // if the file mentions a relevant identifier
+        bool relevant = false;
+
+        // the targets of its #include directives, and if each was quoted
+        vector<pair<string, bool>> includes;
+
+        // if it has an #include whose target is a macro
+        bool computed_include = false;
+
+        // the hashes of the identifiers it names followed by a (, if
+        // requested
+        unordered_set<uint64_t> calls;
+
+        // the SHA-256 digest of its contents, if requested
+        Sha256::Digest digest = {};
+};
+
+// the character classes of the scanner
+enum : unsigned char { OTHER, IDENT_START, IDENT, DIGIT, SPACE, NEWLINE };
+
+static const struct CharClasses {
+        unsigned char of[256];
+        CharClasses() {
+                for (int c = 0; c < 256; c++) {
+                        if (c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+                                of[c] = IDENT_START;
+                        else if (c >= '0' && c <= '9')
+                                of[c] = DIGIT;
+                        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+                                of[c] = SPACE;
+                        else if (c == '\n')
+                                of[c] = NEWLINE;
+                        else
+                                of[c] = OTHER;
+                }
+        }
+        bool ident(char c) const {
+                unsigned char k = of[static_cast<unsigned char>(c)];
+                return k == IDENT_START || k == DIGIT;
+        }
+        unsigned char operator[](char c) const { return of[static_cast<unsigned char>(c)]; }
+} classes;
+
+// Parses the #include, #include_next or #import directive starting after
+// the # at data[i], if it is one, into scan.
+static void scan_directive(const char *data, size_t size, size_t i, FileScan &scan) {
+        while (i < size && classes[data[i]] == SPACE)
+                i++;
+        size_t start = i;
+        while (i < size && classes.ident(data[i]))
+                i++;
+        string_view directive(data + start, i - start);
+        if (directive != "include" && directive != "include_next" && directive != "import")
+                return;
+        while (i < size && classes[data[i]] == SPACE)
+                i++;
+        if (i < size && classes[data[i]] == IDENT_START) {
+                scan.computed_include = true;
+                return;
+        }
+        if (i == size || (data[i] != '"' && data[i] != '<'))
+                return;
+        char close = data[i] == '"' ? '"' : '>';
+        start = ++i;
+        while (i < size && data[i] != close && data[i] != '\n')
+                i++;
+        if (i < size && data[i] == close)
+                scan.includes.push_back({string(data + start, i - start), close == '"'});
+}
+
+// Returns if the n bytes at name look like a macro, e.g. ARRAY_SIZE: no
+// lowercase letters.
+static bool is_macro_like(const char *name, size_t n) {
+        for (size_t i = 0; i < n; i++)
+                if (name[i] >= 'a' && name[i] <= 'z')
+                        return false;
+        return true;
+}
+
+// The hashes of the keywords that can precede a (, which are not calls.
+static const unordered_set<uint64_t> &keyword_hashes() {
+        static const unordered_set<uint64_t> hashes = [] {
+                unordered_set<uint64_t> result;
+                for (string_view keyword : {"if", "while", "for", "switch", "return", "sizeof", "alignof",
+                                            "alignas", "decltype", "typeid", "typeof", "catch", "throw",
+                                            "static_assert", "noexcept", "defined", "new", "delete",
+                                            "operator", "__attribute__", "__typeof__", "__declspec",
+                                            "__has_include", "asm", "__asm__"})
+                        result.insert(fnv1a(keyword.data(), keyword.size()));
+                return result;
+        }();
+        return hashes;
+}
+
+// Scans the size bytes at data for relevant identifiers, includes and, if
+// collect_calls, calls: identifiers followed by a (, other than keywords and
+// macros, which nearly every file uses.
+static void scan_text(const char *data, size_t size, const unordered_set<uint64_t> &relevant,
+                      bool collect_calls, FileScan &scan) {
+        bool line_start = true;
+        size_t i = 0;
+        while (i < size) {
+                switch (classes[data[i]]) {
+                case IDENT_START: {
+                        size_t start = i;
+                        while (i < size && classes.ident(data[i]))
+                                i++;
+                        uint64_t hash = fnv1a(data + start, i - start);
+                        if (!scan.relevant && relevant.count(hash))
+                                scan.relevant = true;
+                        if (collect_calls) {
+                                size_t j = i;
+                                while (j < size && classes[data[j]] == SPACE)
+                                        j++;
+                                if (j < size && data[j] == '(' && !keyword_hashes().count(hash) &&
+                                    !is_macro_like(data + start, i - start))
+                                        scan.calls.insert(hash);
+                        }
+                        line_start = false;
+                        break;
+                }
+                case DIGIT:
+                        // skip numbers, so that e.g. 0x1f is not an identifier.
+                        while (i < size && (classes.ident(data[i]) || data[i] == '.'))
+                                i++;
+                        line_start = false;
+                        break;
+                case SPACE:
+                        i++;
+                        break;
+                case NEWLINE:
+                        i++;
+                        line_start = true;
+                        break;
+                default:
+                        if (data[i] == '#' && line_start)
+                                scan_directive(data, size, i + 1, scan);
+                        i++;
+                        line_start = false;
+                        break;
+                }
+        }
+}
+
+// Returns the canonical form of path, or an empty string if it does not
+// exist.
+static string canonical_path(const string &path) {
+        char resolved[PATH_MAX];
+        if (!realpath(path.c_str(), resolved))
+                return "";
+        return resolved;
+}
+
+static string join_path(const string &dir, const string &path) {
+        if (path.empty() || path[0] == '/' || dir.empty())
+                return path;
+        return dir.back() == '/' ? dir + path : dir + "/" + path;
+}
+
+static string parent_dir(const string &path) {
+        size_t slash = path.rfind('/');
+        return slash == string::npos ? "" : path.substr(0, slash);
+}
+
+// Scans files, caching the scans of headers, which many units share.
+class Prescanner {
+      public:
+        // Files are relevant if they mention an identifier whose hash is in
+        // relevant, or if they are one of files. Scans include the digests
+        // of the files if hash_contents.
+        Prescanner(const unordered_set<uint64_t> &relevant, const unordered_set<string> &files,
+                   bool hash_contents = false)
+            : relevant(relevant), files(files), hash_contents(hash_contents) {}
+
+        // Scans a unit: sets calls to the calls of its main file, and
+        // returns if it or a project header it includes is relevant.
+        bool scan_unit(const PrescanUnit &unit, unordered_set<uint64_t> &calls) {
+                string main_file = canonical_path(join_path(unit.directory, unit.file));
+                if (main_file.empty())
+                        return true; // let libclang report the missing file
+                FileScan main_scan;
+                if (!scan_file(main_file, true, main_scan))
+                        return true;
+                calls = move(main_scan.calls);
+                return walk(unit, main_file, main_scan, [this](const string &path, const FileScan &scan) {
+                        return scan.relevant || files.count(path) > 0;
+                });
+        }
+
+        // Returns the digest of a unit's main file and the project headers
+        // it includes, or nothing if its main file cannot be read or an
+        // include cannot be followed.
+        optional<Sha256::Digest> hash_unit(const PrescanUnit &unit) {
+                string main_file = canonical_path(join_path(unit.directory, unit.file));
+                FileScan main_scan;
+                if (main_file.empty() || !scan_file(main_file, false, main_scan))
+                        return {};
+                Sha256 hasher;
+                bool stopped = walk(unit, main_file, main_scan, [&hasher](const string &path, const FileScan &scan) {
+                        // paths cannot contain NUL, so it ends one unambiguously.
+                        hasher.update(path.c_str(), path.size() + 1);
+                        hasher.update(scan.digest.data(), scan.digest.size());
+                        // no identifier is relevant, so only an unreadable
+                        // header is.
+                        return scan.relevant;
+                });
+                if (stopped)
+                        return {};
+                return hasher.digest();
+        }
+
+      private:
+        // Walks the files of a unit depth-first, each once: its main file,
+        // scanned as main_scan, its forced includes and the project headers
+        // they include. Calls visit on each file until it returns true.
+        // Returns if the walk stopped early, because visit returned true or
+        // an include cannot be followed: a computed one, or a quoted one
+        // that resolves to no file.
+        bool walk(const PrescanUnit &unit, const string &main_file, const FileScan &main_scan,
+                  const function<bool(const string &, const FileScan &)> &visit) {
+                vector<string> include_dirs;
+                for (const auto &dir : unit.include_dirs)
+                        include_dirs.push_back(join_path(unit.directory, dir));
+                for (const auto &dir : unit.system_dirs)
+                        include_dirs.push_back(join_path(unit.directory, dir));
+
+                unordered_set<string> visited = {main_file};
+                vector<pair<string, const FileScan *>> stack = {{main_file, &main_scan}};
+                // forced includes resolve like quoted ones in the command's
+                // directory, and are read before the main file.
+                for (auto it = unit.forced_includes.rbegin(); it != unit.forced_includes.rend(); it++) {
+                        string header = resolve(*it, true, unit.directory, include_dirs);
+                        if (header.empty())
+                                return true;
+                        if (visited.insert(header).second)
+                                stack.push_back({header, header_scan(header)});
+                }
+                while (!stack.empty()) {
+                        auto [path, scan] = stack.back();
+                        stack.pop_back();
+                        if (scan->computed_include || visit(path, *scan))
+                                return true;
+                        for (const auto &include : scan->includes) {
+                                string header = resolve(include.first, include.second, parent_dir(path), include_dirs);
+                                if (header.empty() && include.second)
+                                        return true;
+                                if (!header.empty() && visited.insert(header).second)
+                                        stack.push_back({header, header_scan(header)});
+                        }
+                }
+                return false;
+        }
+
+        // Returns the canonical path include names, or an empty string for
+        // a system header.
+        static string resolve(const string &include, bool quoted, const string &dir,
+                              const vector<string> &include_dirs) {
+                if (quoted) {
+                        string path = canonical_path(join_path(dir, include));
+                        if (!path.empty())
+                                return path;
+                }
+                for (const auto &include_dir : include_dirs) {
+                        string path = canonical_path(join_path(include_dir, include));
+                        if (!path.empty())
+                                return path;
+                }
+                return "";
+        }
+
+        bool scan_file(const string &path, bool collect_calls, FileScan &scan) const {
+                MappedFile file(path);
+                if (!file.ok())
+                        return false;
+                scan_text(file.data(), file.size(), relevant, collect_calls, scan);
+                if (hash_contents) {
+                        Sha256 hasher;
+                        hasher.update(file.data(), file.size());
+                        scan.digest = hasher.digest();
+                }
+                return true;
+        }
+
+        // Returns the scan of the header at path, scanning it if needed.
+        const FileScan *header_scan(const string &path) {
+                {
+                        shared_lock<shared_mutex> guard(headers_lock);
+                        const auto &it = headers.find(path);
+                        if (it != headers.end())
+                                return it->second.get();
+                }
+                auto scan = make_unique<FileScan>();
+                // an unreadable header is left for libclang to report.
+                if (!scan_file(path, false, *scan))
+                        scan->relevant = true;
+                unique_lock<shared_mutex> guard(headers_lock);
+                return headers.emplace(path, move(scan)).first->second.get();
+        }
+
+        const unordered_set<uint64_t> &relevant;
+        const unordered_set<string> &files;
+        bool hash_contents;
+
+        // the scans of headers; the scans never move
+        map<string, unique_ptr<FileScan>> headers;
+        shared_mutex headers_lock;
+};
+
+// Calls fn(i) for every i < n, on num_threads threads.
+static void parallel_for(size_t n, unsigned num_threads, const function<void(size_t)> &fn) {
+        atomic<size_t> next(0);
+        vector<thread> workers;
+        for (unsigned t = 0; t < max(1u, num_threads); t++) {
+                workers.push_back(thread([&] {
+                        for (size_t i = next++; i < n; i = next++)
+                                fn(i);
+                }));
+        }
+        for (auto &worker : workers)
+                worker.join();
+}
+
+vector<bool> prescan_translation_units(const vector<PrescanUnit> &units,
+                                       const vector<string> &identifiers,
+                                       unsigned num_threads) {
+        unordered_set<uint64_t> relevant;
+        for (const auto &id : identifiers)
+                relevant.insert(fnv1a(id.data(), id.size()));
+
+        unordered_set<string> no_files;
+        Prescanner scanner(relevant, no_files);
+        vector<char> is_relevant(units.size(), false);
+        vector<unordered_set<uint64_t>> calls(units.size());
+        parallel_for(units.size(), num_threads, [&](size_t i) {
+                is_relevant[i] = scanner.scan_unit(units[i], calls[i]);
+        });
+
+        // keep the units that share a called name with a relevant unit.
+        unordered_set<uint64_t> relevant_calls;
+        for (size_t i = 0; i < units.size(); i++)
+                if (is_relevant[i])
+                        relevant_calls.insert(calls[i].begin(), calls[i].end());
+        vector<bool> result(units.size());
+        for (size_t i = 0; i < units.size(); i++) {
+                result[i] = is_relevant[i];
+                for (auto it = calls[i].begin(); !result[i] && it != calls[i].end(); it++)
+                        result[i] = relevant_calls.count(*it) > 0;
+        }
+        return result;
+}
+
+vector<bool> find_dependent_units(const vector<PrescanUnit> &units,
+                                  const unordered_set<string> &files,
+                                  unsigned num_threads) {
+        unordered_set<uint64_t> no_identifiers;
+        Prescanner scanner(no_identifiers, files);
+        vector<char> is_dependent(units.size(), false);
+        parallel_for(units.size(), num_threads, [&](size_t i) {
+                unordered_set<uint64_t> calls;
+                is_dependent[i] = scanner.scan_unit(units[i], calls);
+        });
+        return vector<bool>(is_dependent.begin(), is_dependent.end());
+}
+
+vector<optional<Sha256::Digest>> hash_translation_units(const vector<PrescanUnit> &units,
+                                                        unsigned num_threads) {
+        unordered_set<uint64_t> no_identifiers;
+        unordered_set<string> no_files;
+        Prescanner scanner(no_identifiers, no_files, true);
+        vector<optional<Sha256::Digest>> hashes(units.size());
+        parallel_for(units.size(), num_threads, [&](size_t i) {
+                hashes[i] = scanner.hash_unit(units[i]);
+        });
+        return hashes;
+}
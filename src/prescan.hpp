@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "util.hpp"
+
+using namespace std;
+
+// A translation unit, as the prescan sees it.
+struct PrescanUnit {
+        // the main file, relative to directory unless absolute
+        string file;
+
+        // the directory the compile command runs in
+        string directory;
+
+        // the -I and -iquote directories of the command, in order
+        vector<string> include_dirs;
+
+        // the -isystem and -idirafter directories of the command, in order,
+        // searched after include_dirs
+        vector<string> system_dirs;
+
+        // the files of the -include and -imacros options, in order
+        vector<string> forced_includes;
+};
+
+/**
+ * Returns which of units are worth parsing with libclang, scanning them
+ * lexically on num_threads threads.
+ *
+ * A unit is relevant if its main file or a project header it includes
+ * mentions one of identifiers, e.g. a MAVLink struct or a prior-typed
+ * member. Headers are the unit's forced includes and the includes that
+ * resolve against the including file's directory or the unit's include and
+ * system directories; the compiler's own headers are not scanned. A unit
+ * with an include that cannot be followed, a computed #include MACRO or a
+ * quoted include that resolves to no file, is relevant. The one-hop call
+ * graph neighbors of relevant units are kept as well: the units whose main
+ * file names a function that a relevant unit's main file also names. The scan is conservative, so comments and
+ * disabled code can only keep a unit that could have been skipped.
+ */
+vector<bool> prescan_translation_units(const vector<PrescanUnit> &units,
+                                       const vector<string> &identifiers,
+                                       unsigned num_threads);
+
+/**
+ * Returns which of units depend on one of files, canonical paths, scanning
+ * them on num_threads threads: those whose main file is one of files or
+ * includes one, directly or through project headers. Includes resolve as
+ * for prescan_translation_units, so a unit whose main file cannot be read,
+ * or with an include that cannot be followed, counts as dependent.
+ */
+vector<bool> find_dependent_units(const vector<PrescanUnit> &units,
+                                  const unordered_set<string> &files,
+                                  unsigned num_threads);
+
+/**
+ * Returns a SHA-256 digest of each of units, hashing on num_threads threads:
+ * of the paths and contents of its main file and the project headers it
+ * includes, or nothing if its main file cannot be read or it has an include
+ * that cannot be followed. Like the prescan, the walk ignores #if and so
+ * covers every project header the unit could include: given the same
+ * command and compiler headers, units that hash the same preprocess the
+ * same.
+ */
+vector<optional<Sha256::Digest>> hash_translation_units(const vector<PrescanUnit> &units,
+                                                        unsigned num_threads);
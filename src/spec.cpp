@@ -0,0 +1,356 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lmcp.hpp"
+#include "mav.hpp"
+#include "spec.hpp"
+#include "util.hpp"
+
+/*
+ * A compiled spec is laid out as
+ *   SpecHeader
+ *   SpecRecord[num_records]
+ *   the strings the records refer to, unterminated
+ * in the byte order of the machine that compiled it. The magic and version
+ * reject files from other machines or older builds.
+ */
+
+static const char SPEC_MAGIC[8] = {'S', 'A', '4', 'U', 'S', 'P', 'E', 'C'};
+
+// bump whenever the layout or the meaning of a table changes
+static const uint32_t SPEC_VERSION = 2;
+
+struct SpecHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        int32_t num_units;
+        uint32_t num_records;
+        uint64_t strings_size;
+};
+
+// A string in the string section.
+struct SpecString {
+        uint32_t offset;
+        uint32_t length;
+};
+
+enum SpecTable : uint32_t {
+        // key is a source file, field its hash in hex and value 1 for roots
+        SPEC_SOURCE,
+        // key is a unit name and value its ID
+        SPEC_UNIT,
+        // key is a struct and field its frame field
+        SPEC_FRAME_FIELD,
+        // key is a struct, field one of its fields and value the field's unit
+        SPEC_FIELD_UNIT,
+        // key is an LMCP accessor and value the unit it returns
+        SPEC_ACCESSOR,
+};
+
+struct SpecRecord {
+        uint32_t table;
+        SpecString key;
+        SpecString field;
+        int32_t value;
+};
+
+MessageDefinitionType detect_definition_type(const pugi::xml_document &doc) {
+        if (doc.child("mavlink")) {
+                return MAVLINK;
+        }
+        if (doc.child("MDM")) {
+                return LMCP;
+        }
+        return UNKNOWN;
+}
+
+// Returns the canonical form of path, or an empty string if it does not
+// exist.
+static string canonical_path(const string &path) {
+        char resolved[PATH_MAX];
+        if (!realpath(path.c_str(), resolved))
+                return "";
+        return resolved;
+}
+
+// A message definition file and what parsing it found.
+struct DefinitionFile {
+        SpecSource source;
+        pugi::xml_document doc;
+
+        // why the file could not be parsed, if it could not
+        string error;
+
+        // the paths of the files it includes, relative to it
+        vector<string> includes;
+};
+
+// Parses file->source.path into file. Run on a thread per file.
+static void parse_definition(DefinitionFile *file) {
+        MappedFile xml(file->source.path);
+        if (!xml.ok()) {
+                file->error = xml.error();
+                return;
+        }
+        file->source.hash = fnv1a(xml.data(), xml.size());
+        pugi::xml_parse_result parsed = file->doc.load_buffer(xml.data(), xml.size());
+        if (!parsed) {
+                file->error = parsed.description();
+                return;
+        }
+        for (pugi::xml_node include = file->doc.child("mavlink").child("include"); include;
+             include = include.next_sibling("include"))
+                file->includes.push_back(include.child_value());
+}
+
+// Adds the tables of doc to spec, numbering new units after its others.
+static void merge_definition(const pugi::xml_document &doc, MessageSpec &spec) {
+        switch (spec.kind) {
+        case MAVLINK: {
+                map<string, string> frame_fields = get_types_to_frame_field(doc);
+                spec.type_to_semantic.insert(frame_fields.begin(), frame_fields.end());
+                map<string, map<string, int>> field_units =
+                    get_type_to_field_to_unit(doc, spec.unitname_to_id, spec.num_units);
+                for (auto &type : field_units)
+                        spec.type_to_field_to_unit[type.first].insert(type.second.begin(), type.second.end());
+                break;
+        }
+        case LMCP: {
+                map<string, TypeInfo> accessors =
+                    get_units_of_functions(doc, spec.unitname_to_id, spec.num_units);
+                spec.function_to_return_type.insert(accessors.begin(), accessors.end());
+                break;
+        }
+        case UNKNOWN:
+        default:
+                break;
+        }
+}
+
+string load_message_definitions(const vector<string> &paths, MessageSpec &spec) {
+        // Files are parsed in waves: the files named so far in parallel,
+        // then the new files they include.
+        vector<unique_ptr<DefinitionFile>> files;
+        set<string> seen;
+        vector<SpecSource> wave;
+        for (const auto &path : paths) {
+                string canonical = canonical_path(path);
+                if (canonical.empty())
+                        return path + ": " + strerror(errno);
+                if (seen.insert(canonical).second)
+                        wave.push_back({canonical, 0, true});
+        }
+
+        while (!wave.empty()) {
+                size_t first = files.size();
+                vector<thread> parsers;
+                for (const auto &source : wave) {
+                        files.push_back(make_unique<DefinitionFile>());
+                        files.back()->source = source;
+                }
+                for (size_t i = first; i < files.size(); i++)
+                        parsers.push_back(thread(parse_definition, files[i].get()));
+                for (auto &parser : parsers)
+                        parser.join();
+
+                wave.clear();
+                for (size_t i = first; i < files.size(); i++) {
+                        const DefinitionFile &file = *files[i];
+                        if (!file.error.empty())
+                                return file.source.path + ": " + file.error;
+                        string dir = file.source.path.substr(0, file.source.path.rfind('/') + 1);
+                        for (const auto &include : file.includes) {
+                                string canonical = canonical_path(include[0] == '/' ? include : dir + include);
+                                if (canonical.empty()) {
+                                        cerr << "[WARN] " << file.source.path << " includes missing file "
+                                             << include << endl;
+                                        continue;
+                                }
+                                if (seen.insert(canonical).second)
+                                        wave.push_back({canonical, 0, false});
+                        }
+                }
+        }
+
+        // Merged in load order, so unit IDs do not depend on the timing of
+        // the parsers.
+        MessageSpec result;
+        for (const auto &file : files) {
+                MessageDefinitionType kind = detect_definition_type(file->doc);
+                if (kind == UNKNOWN)
+                        return file->source.path + ": message not in a supported spec";
+                if (result.kind != UNKNOWN && kind != result.kind)
+                        return file->source.path + ": cannot mix MAVLink and LMCP definitions";
+                result.kind = kind;
+                result.sources.push_back(file->source);
+                merge_definition(file->doc, result);
+        }
+        spec = move(result);
+        return "";
+}
+
+// Collects the strings of a spec being written, each stored once.
+class StringSection {
+      public:
+        SpecString add(const string &s) {
+                const auto &it = offsets.find(s);
+                if (it != offsets.end())
+                        return it->second;
+                SpecString ref = {static_cast<uint32_t>(data.size()), static_cast<uint32_t>(s.size())};
+                data += s;
+                offsets.emplace(s, ref);
+                return ref;
+        }
+
+        string data;
+
+      private:
+        map<string, SpecString> offsets;
+};
+
+string write_compiled_spec(const string &path, const MessageSpec &spec) {
+        StringSection strings;
+        vector<SpecRecord> records;
+        for (const auto &source : spec.sources) {
+                char hash[17];
+                snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(source.hash));
+                records.push_back({SPEC_SOURCE, strings.add(source.path), strings.add(hash), source.root});
+        }
+        for (const auto &unit : spec.unitname_to_id)
+                records.push_back({SPEC_UNIT, strings.add(unit.first), {0, 0}, unit.second});
+        for (const auto &frame : spec.type_to_semantic)
+                records.push_back({SPEC_FRAME_FIELD, strings.add(frame.first), strings.add(frame.second), 0});
+        for (const auto &type : spec.type_to_field_to_unit)
+                for (const auto &field : type.second)
+                        records.push_back({SPEC_FIELD_UNIT, strings.add(type.first), strings.add(field.first), field.second});
+        for (const auto &accessor : spec.function_to_return_type) {
+                // accessors are typed by the one unit of their field.
+                if (accessor.second.units.size() != 1)
+                        return "accessor " + accessor.first + " does not have exactly one unit";
+                records.push_back({SPEC_ACCESSOR, strings.add(accessor.first), {0, 0},
+                                   *accessor.second.units.begin()});
+        }
+
+        SpecHeader header;
+        memcpy(header.magic, SPEC_MAGIC, sizeof(SPEC_MAGIC));
+        header.version = SPEC_VERSION;
+        header.kind = spec.kind;
+        header.num_units = spec.num_units;
+        header.num_records = records.size();
+        header.strings_size = strings.data.size();
+
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(SpecRecord));
+        out.write(strings.data.data(), strings.data.size());
+        out.close();
+        if (!out)
+                return strerror(errno);
+        return "";
+}
+
+string read_compiled_spec(const string &path, const vector<string> &paths, MessageSpec &spec) {
+        MappedFile file(path);
+        if (!file.ok())
+                return file.error();
+
+        SpecHeader header;
+        if (file.size() < sizeof(header))
+                return "truncated header";
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, SPEC_MAGIC, sizeof(SPEC_MAGIC)) != 0)
+                return "not a compiled spec";
+        if (header.version != SPEC_VERSION)
+                return "compiled by an incompatible version (" + to_string(header.version) + ")";
+        if (header.kind != MAVLINK && header.kind != LMCP)
+                return "unknown message definition type";
+        size_t records_size = static_cast<size_t>(header.num_records) * sizeof(SpecRecord);
+        if (file.size() != sizeof(header) + records_size + header.strings_size)
+                return "size does not match its header";
+
+        const char *records = file.data() + sizeof(header);
+        const char *strings = records + records_size;
+        bool in_bounds = true;
+        auto str = [&](const SpecString &s) {
+                if (static_cast<uint64_t>(s.offset) + s.length > header.strings_size) {
+                        in_bounds = false;
+                        return string_view();
+                }
+                return string_view(strings + s.offset, s.length);
+        };
+
+        MessageSpec result;
+        result.kind = static_cast<MessageDefinitionType>(header.kind);
+        result.num_units = header.num_units;
+        // accessors are typed once every unit name is known.
+        vector<SpecRecord> accessors;
+        for (uint32_t i = 0; i < header.num_records; i++) {
+                SpecRecord record;
+                memcpy(&record, records + i * sizeof(SpecRecord), sizeof(record));
+                switch (record.table) {
+                case SPEC_SOURCE:
+                        result.sources.push_back({string(str(record.key)),
+                                                  strtoull(string(str(record.field)).c_str(), nullptr, 16),
+                                                  record.value != 0});
+                        break;
+                case SPEC_UNIT:
+                        result.unitname_to_id.emplace(str(record.key), record.value);
+                        break;
+                case SPEC_FRAME_FIELD:
+                        result.type_to_semantic.emplace(str(record.key), str(record.field));
+                        break;
+                case SPEC_FIELD_UNIT:
+                        result.type_to_field_to_unit[string(str(record.key))].emplace(str(record.field), record.value);
+                        break;
+                case SPEC_ACCESSOR:
+                        accessors.push_back(record);
+                        break;
+                default:
+                        return "unknown table " + to_string(record.table);
+                }
+        }
+
+        map<int, string> id_to_unitname = invert_map(result.unitname_to_id);
+        for (const auto &record : accessors) {
+                const auto &unit = id_to_unitname.find(record.value);
+                if (unit == id_to_unitname.end())
+                        return "accessor with an unknown unit " + to_string(record.value);
+                result.function_to_return_type.emplace(str(record.key), lmcp_accessor_type(unit->second, record.value));
+        }
+        if (!in_bounds)
+                return "string out of bounds";
+
+        // the spec is current if it was compiled from paths, and none of the
+        // files it was compiled from changed since.
+        set<string> roots;
+        for (const auto &p : paths) {
+                string canonical = canonical_path(p);
+                if (canonical.empty())
+                        return p + ": " + strerror(errno);
+                roots.insert(canonical);
+        }
+        for (const auto &source : result.sources) {
+                if (source.root && !roots.erase(source.path))
+                        return "compiled from " + source.path + ", which was not given";
+                MappedFile xml(source.path);
+                if (!xml.ok())
+                        return source.path + ": " + xml.error();
+                if (fnv1a(xml.data(), xml.size()) != source.hash)
+                        return source.path + " changed since it was compiled";
+        }
+        if (!roots.empty())
+                return "not compiled from " + *roots.begin();
+
+        spec = move(result);
+        return "";
+}
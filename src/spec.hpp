@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pugixml.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+
+enum MessageDefinitionType { UNKNOWN, MAVLINK, LMCP };
+
+// A message definition file a spec was loaded from.
+struct SpecSource {
+        // the canonical path of the file
+        string path;
+
+        // the FNV-1a hash of its contents
+        uint64_t hash;
+
+        // true if the file was given on the command line rather than included
+        bool root;
+};
+
+// The tables the analysis takes from a message spec.
+struct MessageSpec {
+        MessageDefinitionType kind = UNKNOWN;
+
+        // the files the tables were extracted from, in load order
+        vector<SpecSource> sources;
+
+        // maps unit names (e.g. centimeter) to their IDs
+        map<string, int> unitname_to_id;
+        int num_units = 0;
+
+        // MAVLink: maps struct names to the name of their frame field
+        map<string, string> type_to_semantic;
+
+        // MAVLink: maps struct names to the unit IDs of their fields
+        map<string, map<string, int>> type_to_field_to_unit;
+
+        // LMCP: maps accessor names to the types they return
+        map<string, TypeInfo> function_to_return_type;
+};
+
+MessageDefinitionType detect_definition_type(const pugi::xml_document &doc);
+
+/**
+ * Loads the message definitions at paths and the files they <include>, which
+ * are looked up relative to the including file. The files are parsed in
+ * parallel and merged into spec, so units share one ID space across them.
+ * Returns an empty string on success, or else why the spec could not be
+ * loaded.
+ */
+string load_message_definitions(const vector<string> &paths, MessageSpec &spec);
+
+/**
+ * Compiled specs are binary snapshots of a MessageSpec that can be loaded
+ * without parsing XML. A compiled spec records the hashes of the files it
+ * was compiled from, and is only loaded if it was compiled from paths and
+ * none of its files changed since.
+ *
+ * Both functions return an empty string on success, or else why they failed.
+ */
+string write_compiled_spec(const string &path, const MessageSpec &spec);
+string read_compiled_spec(const string &path, const vector<string> &paths, MessageSpec &spec);
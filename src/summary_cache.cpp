@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <tuple>
+#include <vector>
+
+extern "C" {
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include "summary_cache.hpp"
+#include "util.hpp"
+
+/*
+ * The cache directory holds
+ *   xx/<key>   the entries, fanned out by the first two hex digits of
+ *              their keys so that no directory gets too large
+ *   stats      the counts of every run, as "name count" lines
+ * Writers create entries under a temporary name and rename them, so a
+ * reader never maps a partial entry. A writer that crashes leaves its
+ * temporary file behind, which evict() removes once it is old enough that
+ * no writer can still be writing it.
+ */
+
+static const char STATS_FILE[] = "stats";
+
+// the age in seconds after which a temporary file is abandoned
+static const int64_t TEMPORARY_MAX_AGE = 60 * 60;
+
+// Creates the directory at path unless it exists.
+static bool make_dir(const string &path) {
+        return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+}
+
+// Calls fn with the path and the stat of every entry in the cache in dir,
+// and of every temporary file an entry is written to, and if it is one.
+// Returns false if dir cannot be read.
+static bool for_each_entry(const string &dir,
+                           const function<void(const string &, const struct stat &, bool)> &fn) {
+        DIR *top = opendir(dir.c_str());
+        if (!top)
+                return false;
+        while (struct dirent *fanout = readdir(top)) {
+                if (strlen(fanout->d_name) != 2 || fanout->d_name[0] == '.')
+                        continue;
+                string fanout_path = dir + "/" + fanout->d_name;
+                DIR *sub = opendir(fanout_path.c_str());
+                if (!sub)
+                        continue;
+                while (struct dirent *entry = readdir(sub)) {
+                        if (entry->d_name[0] == '.')
+                                continue;
+                        // keys are hex digits, so only temporary names have a dot.
+                        bool temporary = strchr(entry->d_name, '.') != nullptr;
+                        string path = fanout_path + "/" + entry->d_name;
+                        struct stat st;
+                        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                                fn(path, st, temporary);
+                }
+                closedir(sub);
+        }
+        closedir(top);
+        return true;
+}
+
+SummaryCache::SummaryCache(const string &dir, const Sha256::Digest &context) : dir(dir), context(context) {
+        if (!make_dir(dir))
+                failure = strerror(errno);
+}
+
+string SummaryCache::key(const string &command, const Sha256::Digest &unit_digest) const {
+        Sha256 hasher;
+        hasher.update(context.data(), context.size());
+        hasher.update(unit_digest.data(), unit_digest.size());
+        hasher.update(command.data(), command.size());
+        return Sha256::hex(hasher.digest());
+}
+
+string SummaryCache::entry_path(const string &key) const {
+        return dir + "/" + key.substr(0, 2) + "/" + key;
+}
+
+unique_ptr<SummaryStore> SummaryCache::lookup(const string &key) {
+        string path = entry_path(key);
+        auto entry = make_unique<SummaryStore>(path);
+        if (!entry->ok() || entry->num_translation_units() != 1) {
+                run.misses++;
+                return nullptr;
+        }
+        // a hit makes the entry the most recently used.
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        run.hits++;
+        return entry;
+}
+
+string SummaryCache::insert(const string &key, const SummarySnapshot &snapshot) {
+        if (!make_dir(dir + "/" + key.substr(0, 2)))
+                return strerror(errno);
+        string error = write_summary_store(entry_path(key), snapshot);
+        if (error.empty())
+                run.stores++;
+        return error;
+}
+
+void SummaryCache::evict(uint64_t max_bytes) {
+        // (modification time, size, path) of every entry
+        vector<tuple<int64_t, uint64_t, string>> entries;
+        uint64_t total = 0;
+        int64_t abandoned = time(nullptr) - TEMPORARY_MAX_AGE;
+        for_each_entry(dir, [&](const string &path, const struct stat &st, bool temporary) {
+                if (!temporary) {
+                        entries.emplace_back(st.st_mtime, st.st_size, path);
+                        total += st.st_size;
+                } else if (st.st_mtime < abandoned && unlink(path.c_str()) == 0) {
+                        run.evictions++;
+                }
+        });
+
+        sort(entries.begin(), entries.end());
+        for (const auto &entry : entries) {
+                if (total <= max_bytes)
+                        break;
+                // another run may have evicted it already.
+                if (unlink(get<2>(entry).c_str()) == 0)
+                        run.evictions++;
+                total -= get<1>(entry);
+        }
+}
+
+// Reads "name count" lines into totals.
+static void parse_statistics(const string &text, CacheStatistics &totals) {
+        size_t start = 0;
+        while (start < text.size()) {
+                size_t end = text.find('\n', start);
+                if (end == string::npos)
+                        end = text.size();
+                string line = text.substr(start, end - start);
+                start = end + 1;
+                size_t space = line.find(' ');
+                if (space == string::npos)
+                        continue;
+                string name = line.substr(0, space);
+                uint64_t count = strtoull(line.c_str() + space + 1, nullptr, 10);
+                if (name == "hits")
+                        totals.hits = count;
+                else if (name == "misses")
+                        totals.misses = count;
+                else if (name == "stores")
+                        totals.stores = count;
+                else if (name == "evictions")
+                        totals.evictions = count;
+        }
+}
+
+// Reads the rest of the file open as fd.
+static string read_all(int fd) {
+        string text;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+                text.append(buffer, n);
+        return text;
+}
+
+string SummaryCache::flush() {
+        string path = dir + "/" + STATS_FILE;
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+        if (fd == -1)
+                return strerror(errno);
+        // runs on other machines update the same file.
+        if (flock(fd, LOCK_EX) == -1) {
+                string error = strerror(errno);
+                close(fd);
+                return error;
+        }
+        CacheStatistics totals;
+        parse_statistics(read_all(fd), totals);
+        totals.hits += run.hits;
+        totals.misses += run.misses;
+        totals.stores += run.stores;
+        totals.evictions += run.evictions;
+        string text = "hits " + to_string(totals.hits) + "\n" +
+                      "misses " + to_string(totals.misses) + "\n" +
+                      "stores " + to_string(totals.stores) + "\n" +
+                      "evictions " + to_string(totals.evictions) + "\n";
+        string error;
+        if (ftruncate(fd, 0) == -1 || pwrite(fd, text.data(), text.size(), 0) != static_cast<ssize_t>(text.size()))
+                error = strerror(errno);
+        else
+                run = CacheStatistics();
+        close(fd);
+        return error;
+}
+
+string SummaryCache::statistics(CacheStatistics &totals, uint64_t &entries, uint64_t &bytes,
+                                uint64_t &temporaries, uint64_t &temporary_bytes) const {
+        totals = CacheStatistics();
+        entries = 0;
+        bytes = 0;
+        temporaries = 0;
+        temporary_bytes = 0;
+        string path = dir + "/" + STATS_FILE;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+                flock(fd, LOCK_SH);
+                parse_statistics(read_all(fd), totals);
+                close(fd);
+        } else if (errno != ENOENT) {
+                return strerror(errno);
+        }
+
+        bool listed = for_each_entry(dir, [&](const string &, const struct stat &st, bool temporary) {
+                (temporary ? temporaries : entries)++;
+                (temporary ? temporary_bytes : bytes) += st.st_size;
+        });
+        return listed ? "" : strerror(errno);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "summary_store.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+// Counts of the uses of a summary cache.
+struct CacheStatistics {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stores = 0;
+        uint64_t evictions = 0;
+};
+
+/**
+ * A content-addressed cache of the summaries of translation units, kept in
+ * a directory that may be shared between machines, e.g. over NFS.
+ *
+ * An entry is a summary store of one TU, named by a SHA-256 digest of
+ * everything its summaries depend on: the analyzer, the message spec and prior types of
+ * the run (the context), and the TU's command and the files it includes.
+ * Entries are never modified once written, so concurrent runs at most race
+ * to write the same contents. Hits update an entry's modification time, so
+ * evict() drops the least recently used entries first.
+ */
+class SummaryCache {
+      public:
+        // Uses the cache in dir, creating it if needed. context is a digest
+        // of what every summary of this run depends on.
+        SummaryCache(const string &dir, const Sha256::Digest &context);
+
+        bool ok() const { return failure.empty(); }
+        const string &error() const { return failure; }
+
+        // Returns the key of the TU compiled by command, a command key, whose
+        // files have the digest unit_digest: a SHA-256 digest of both and
+        // the context, as 64 hex digits.
+        string key(const string &command, const Sha256::Digest &unit_digest) const;
+
+        // Returns the entry for key, or nullptr if there is none.
+        unique_ptr<SummaryStore> lookup(const string &key);
+
+        // Writes snapshot, of a single TU, as the entry for key. Returns an
+        // empty string on success, or else why it failed.
+        string insert(const string &key, const SummarySnapshot &snapshot);
+
+        // Removes the least recently used entries until the rest take at
+        // most max_bytes, and the temporary files of writers that crashed.
+        void evict(uint64_t max_bytes);
+
+        // Returns this run's counts.
+        const CacheStatistics &counts() const { return run; }
+
+        // Adds this run's counts to the totals of the cache, and resets
+        // them. Returns an empty string on success, or else why it failed.
+        string flush();
+
+        // Sets totals to the counts of every run that used the cache,
+        // entries and bytes to its current size, and temporaries and
+        // temporary_bytes to the size of the entries being written or
+        // abandoned by crashed writers.
+        string statistics(CacheStatistics &totals, uint64_t &entries, uint64_t &bytes,
+                          uint64_t &temporaries, uint64_t &temporary_bytes) const;
+
+      private:
+        string entry_path(const string &key) const;
+
+        string dir;
+        Sha256::Digest context;
+        string failure;
+        CacheStatistics run;
+};
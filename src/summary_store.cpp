@@ -0,0 +1,710 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include "summary_store.hpp"
+#include "units.hpp"
+
+/*
+ * A summary store is laid out as
+ *   StoreHeader
+ *   SECTION_COUNT arrays of fixed-size records, each 8-byte aligned
+ * in the byte order of the machine that wrote it. The header gives the
+ * offset and record count of each array. Records refer to each other by
+ * index, and to runs of records by StoreRange, so a mapped store is used in
+ * place; nothing is read until it is asked for.
+ */
+
+static const char STORE_MAGIC[8] = {'S', 'A', '4', 'U', 'S', 'U', 'M', 'S'};
+
+// bump whenever the layout or the meaning of a section changes
+static const uint32_t STORE_VERSION = 3;
+
+enum StoreSectionId : unsigned {
+        // StoreString, into SECTION_STRING_DATA
+        SECTION_STRINGS,
+        // the bytes of all strings, unterminated
+        SECTION_STRING_DATA,
+        // a string per unit name, by unit ID
+        SECTION_UNITS,
+        // StoreUnit, by TU number
+        SECTION_TUS,
+        // StoreFunction, grouped by TU and sorted by name within one
+        SECTION_FUNCTIONS,
+        // the indices of all functions, sorted by name
+        SECTION_NAME_INDEX,
+        // the strings and types that callees and calls refer to
+        SECTION_IDS,
+        // StoreContext, the calling contexts of a callee
+        SECTION_CONTEXTS,
+        // StoreRange of the types of one call's arguments, into SECTION_IDS
+        SECTION_CALLS,
+        // StoreParam
+        SECTION_PARAMS,
+        // StoreVariable, the stores of a function
+        SECTION_STORES,
+        // StoreType, each distinct TypeInfo once
+        SECTION_TYPES,
+        // the frames and units of types
+        SECTION_INTS,
+        // StoreSource
+        SECTION_SOURCES,
+        // StoreDimension
+        SECTION_DIMENSIONS,
+        // StoreDiagnostic, grouped by TU
+        SECTION_DIAGNOSTICS,
+        SECTION_COUNT,
+};
+
+struct StoreSection {
+        uint64_t offset;
+        uint64_t count;
+};
+
+struct StoreHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_sections;
+        StoreSection sections[SECTION_COUNT];
+};
+
+// A run of count records starting at begin.
+struct StoreRange {
+        uint32_t begin;
+        uint32_t count;
+};
+
+struct StoreString {
+        uint32_t offset;
+        uint32_t length;
+};
+
+struct StoreUnit {
+        uint32_t file;
+        uint32_t key;
+        StoreRange functions;
+        StoreRange diagnostics;
+};
+
+enum StoreFunctionFlags : uint32_t {
+        // the function is defined in its TU, by the definitions in usrs
+        FUNCTION_DEFINED = 1,
+        // the function is defined here and in
+        // functions_with_intrinsic_variables
+        FUNCTION_INTRINSIC = 2,
+};
+
+struct StoreFunction {
+        uint32_t name;
+        uint32_t tu;
+        uint32_t flags;
+        int32_t num_params;
+        // strings, in SECTION_IDS
+        StoreRange callees;
+        StoreRange usrs;
+        StoreRange contexts;
+        StoreRange params;
+        StoreRange stores;
+};
+
+struct StoreContext {
+        uint32_t callee;
+        // into SECTION_CALLS
+        StoreRange calls;
+};
+
+struct StoreParam {
+        int32_t param;
+        uint32_t kind;
+};
+
+struct StoreVariable {
+        uint32_t name;
+        uint32_t type;
+};
+
+struct StoreType {
+        // into SECTION_INTS
+        StoreRange frames;
+        StoreRange units;
+        // into SECTION_SOURCES
+        StoreRange sources;
+        // into SECTION_DIMENSIONS, or -1 if the type has no dimension
+        int32_t dimension;
+};
+
+struct StoreSource {
+        uint32_t kind;
+        int32_t param_no;
+        uint32_t var_name;
+};
+
+struct StoreDimension {
+        int32_t coefficients[SI_BASE_UNITS_COUNT];
+        int32_t reserved;
+        int64_t scalar_numerator;
+        int64_t scalar_denominator;
+};
+
+// A Diagnostic; its strings are empty where they do not apply.
+struct StoreDiagnostic {
+        uint32_t kind;
+        uint32_t file;
+        uint32_t line;
+        uint32_t variable;
+        uint32_t expected;
+        uint32_t actual;
+        uint32_t message;
+        // strings, in SECTION_IDS
+        StoreRange trace;
+};
+
+static const size_t SECTION_RECORD_SIZES[SECTION_COUNT] = {
+    sizeof(StoreString),   sizeof(char),          sizeof(uint32_t),
+    sizeof(StoreUnit),     sizeof(StoreFunction), sizeof(uint32_t),
+    sizeof(uint32_t),      sizeof(StoreContext),  sizeof(StoreRange),
+    sizeof(StoreParam),    sizeof(StoreVariable), sizeof(StoreType),
+    sizeof(int32_t),       sizeof(StoreSource),   sizeof(StoreDimension),
+    sizeof(StoreDiagnostic),
+};
+
+static size_t align8(size_t n) {
+        return (n + 7) & ~static_cast<size_t>(7);
+}
+
+// Collects the sections of a store being written.
+class StoreBuilder {
+      public:
+        uint32_t add_string(const string &s) {
+                const auto &it = string_ids.find(s);
+                if (it != string_ids.end())
+                        return it->second;
+                uint32_t id = strings.size();
+                strings.push_back({static_cast<uint32_t>(string_data.size()),
+                                   static_cast<uint32_t>(s.size())});
+                string_data += s;
+                string_ids.emplace(s, id);
+                return id;
+        }
+
+        uint32_t add_type(const TypeInfo &ti) {
+                vector<tuple<int, int, uint32_t>> type_sources;
+                for (const auto &source : ti.source)
+                        type_sources.emplace_back(source.kind, source.param_no,
+                                                  add_string(source.var_name));
+                int32_t dimension = ti.dimension ? add_dimension(ti.dimension.value()) : -1;
+                TypeKey key(ti.frames, ti.units, type_sources, dimension);
+                const auto &it = type_ids.find(key);
+                if (it != type_ids.end())
+                        return it->second;
+
+                StoreType type;
+                type.frames = {static_cast<uint32_t>(ints.size()), static_cast<uint32_t>(ti.frames.size())};
+                ints.insert(ints.end(), ti.frames.begin(), ti.frames.end());
+                type.units = {static_cast<uint32_t>(ints.size()), static_cast<uint32_t>(ti.units.size())};
+                ints.insert(ints.end(), ti.units.begin(), ti.units.end());
+                type.sources = {static_cast<uint32_t>(sources.size()), static_cast<uint32_t>(type_sources.size())};
+                for (const auto &source : type_sources)
+                        sources.push_back({static_cast<uint32_t>(get<0>(source)),
+                                           get<1>(source), get<2>(source)});
+                type.dimension = dimension;
+
+                uint32_t id = types.size();
+                types.push_back(type);
+                type_ids.emplace(move(key), id);
+                return id;
+        }
+
+        void add_function(const string &name, uint32_t tu, uint32_t flags,
+                          const FunctionSummary &summary) {
+                StoreFunction fn;
+                fn.name = add_string(name);
+                fn.tu = tu;
+                fn.flags = flags;
+                fn.num_params = summary.num_params;
+
+                fn.callees = {static_cast<uint32_t>(ids.size()), static_cast<uint32_t>(summary.callees.size())};
+                for (const auto &callee : summary.callees)
+                        ids.push_back(add_string(callee));
+
+                fn.usrs = {static_cast<uint32_t>(ids.size()), static_cast<uint32_t>(summary.usrs.size())};
+                for (const auto &usr : summary.usrs)
+                        ids.push_back(add_string(usr));
+
+                fn.contexts = {static_cast<uint32_t>(contexts.size()),
+                               static_cast<uint32_t>(summary.calling_context.size())};
+                for (const auto &context : summary.calling_context) {
+                        StoreContext c;
+                        c.callee = add_string(context.first);
+                        c.calls = {static_cast<uint32_t>(calls.size()), static_cast<uint32_t>(context.second.size())};
+                        for (const auto &call : context.second) {
+                                // intern the arguments before taking the
+                                // run of IDs that refers to them.
+                                vector<uint32_t> args;
+                                for (const auto &arg : call)
+                                        args.push_back(add_type(arg));
+                                calls.push_back({static_cast<uint32_t>(ids.size()), static_cast<uint32_t>(args.size())});
+                                ids.insert(ids.end(), args.begin(), args.end());
+                        }
+                        contexts.push_back(c);
+                }
+
+                fn.params = {static_cast<uint32_t>(params.size()),
+                             static_cast<uint32_t>(summary.param_to_typesource_kind.size())};
+                for (const auto &param : summary.param_to_typesource_kind)
+                        params.push_back({param.first, static_cast<uint32_t>(param.second)});
+
+                fn.stores = {static_cast<uint32_t>(stores.size()),
+                             static_cast<uint32_t>(summary.store_to_typeinfo.size())};
+                for (const auto &store : summary.store_to_typeinfo) {
+                        uint32_t variable = add_string(store.first);
+                        stores.push_back({variable, add_type(store.second)});
+                }
+                functions.push_back(fn);
+        }
+
+        void add_diagnostic(const Diagnostic &d) {
+                StoreDiagnostic stored;
+                stored.kind = d.kind;
+                stored.file = add_string(d.file);
+                stored.line = d.line;
+                stored.variable = add_string(d.variable);
+                stored.expected = add_string(d.expected);
+                stored.actual = add_string(d.actual);
+                stored.message = add_string(d.message);
+                vector<uint32_t> trace;
+                for (const auto &fn : d.trace)
+                        trace.push_back(add_string(fn));
+                stored.trace = {static_cast<uint32_t>(ids.size()), static_cast<uint32_t>(trace.size())};
+                ids.insert(ids.end(), trace.begin(), trace.end());
+                diagnostics.push_back(stored);
+        }
+
+        vector<StoreString> strings;
+        string string_data;
+        vector<uint32_t> units;
+        vector<StoreUnit> tus;
+        vector<StoreFunction> functions;
+        vector<uint32_t> name_index;
+        vector<uint32_t> ids;
+        vector<StoreContext> contexts;
+        vector<StoreRange> calls;
+        vector<StoreParam> params;
+        vector<StoreVariable> stores;
+        vector<StoreType> types;
+        vector<int32_t> ints;
+        vector<StoreSource> sources;
+        vector<StoreDimension> dimensions;
+        vector<StoreDiagnostic> diagnostics;
+
+      private:
+        typedef tuple<set<int>, set<int>, vector<tuple<int, int, uint32_t>>, int32_t> TypeKey;
+
+        int32_t add_dimension(DimensionId id) {
+                const auto &it = dimension_ids.find(id);
+                if (it != dimension_ids.end())
+                        return it->second;
+                const Dimension &d = get_dimension(id);
+                StoreDimension stored;
+                for (int i = 0; i < SI_BASE_UNITS_COUNT; i++)
+                        stored.coefficients[i] = d.coefficients[i];
+                stored.reserved = 0;
+                stored.scalar_numerator = d.scalar_numerator;
+                stored.scalar_denominator = d.scalar_denominator;
+                int32_t index = dimensions.size();
+                dimensions.push_back(stored);
+                dimension_ids.emplace(id, index);
+                return index;
+        }
+
+        unordered_map<string, uint32_t> string_ids;
+        map<TypeKey, uint32_t> type_ids;
+        map<DimensionId, int32_t> dimension_ids;
+};
+
+string write_summary_store(const string &path, const SummarySnapshot &snapshot) {
+        StoreBuilder b;
+        for (const auto &name : snapshot.unit_names)
+                b.units.push_back(b.add_string(name));
+        for (const auto &stored : snapshot.translation_units) {
+                const map<string, FunctionSummary> &summaries = snapshot.fn_summaries.at(stored.tu);
+                StoreUnit unit;
+                unit.file = b.add_string(stored.file);
+                unit.key = b.add_string(stored.key);
+                unit.functions = {static_cast<uint32_t>(b.functions.size()),
+                                  static_cast<uint32_t>(summaries.size())};
+                for (const auto &fn : summaries) {
+                        uint32_t flags = 0;
+                        if (!fn.second.usrs.empty())
+                                flags |= FUNCTION_DEFINED;
+                        // only where it is defined, so that forgetting the
+                        // TUs that define a function forgets it as a root.
+                        if ((flags & FUNCTION_DEFINED) &&
+                            snapshot.functions_with_intrinsic_variables.count(fn.first))
+                                flags |= FUNCTION_INTRINSIC;
+                        b.add_function(fn.first, b.tus.size(), flags, fn.second);
+                }
+                const vector<Diagnostic> &found = snapshot.parse_diagnostics.at(stored.tu);
+                unit.diagnostics = {static_cast<uint32_t>(b.diagnostics.size()),
+                                    static_cast<uint32_t>(found.size())};
+                for (const auto &d : found)
+                        b.add_diagnostic(d);
+                b.tus.push_back(unit);
+        }
+        if (b.string_data.size() > UINT32_MAX || b.ids.size() > UINT32_MAX ||
+            b.ints.size() > UINT32_MAX)
+                return "too many summaries for one store";
+
+        for (uint32_t f = 0; f < b.functions.size(); f++)
+                b.name_index.push_back(f);
+        auto name = [&b](uint32_t f) {
+                const StoreString &s = b.strings[b.functions[f].name];
+                return string_view(b.string_data.data() + s.offset, s.length);
+        };
+        stable_sort(b.name_index.begin(), b.name_index.end(),
+                    [&name](uint32_t x, uint32_t y) { return name(x) < name(y); });
+
+        const pair<const void *, size_t> contents[SECTION_COUNT] = {
+            {b.strings.data(), b.strings.size()},
+            {b.string_data.data(), b.string_data.size()},
+            {b.units.data(), b.units.size()},
+            {b.tus.data(), b.tus.size()},
+            {b.functions.data(), b.functions.size()},
+            {b.name_index.data(), b.name_index.size()},
+            {b.ids.data(), b.ids.size()},
+            {b.contexts.data(), b.contexts.size()},
+            {b.calls.data(), b.calls.size()},
+            {b.params.data(), b.params.size()},
+            {b.stores.data(), b.stores.size()},
+            {b.types.data(), b.types.size()},
+            {b.ints.data(), b.ints.size()},
+            {b.sources.data(), b.sources.size()},
+            {b.dimensions.data(), b.dimensions.size()},
+            {b.diagnostics.data(), b.diagnostics.size()},
+        };
+
+        StoreHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        header.version = STORE_VERSION;
+        header.num_sections = SECTION_COUNT;
+        size_t offset = align8(sizeof(header));
+        for (unsigned s = 0; s < SECTION_COUNT; s++) {
+                header.sections[s] = {offset, contents[s].second};
+                offset = align8(offset + contents[s].second * SECTION_RECORD_SIZES[s]);
+        }
+
+        // written next to path and renamed over it, so that readers that
+        // mapped the old store keep a consistent copy. The name is unique
+        // to this process, as stores may be shared between machines.
+        char host[256] = "";
+        gethostname(host, sizeof(host) - 1);
+        string temp_path = path + ".tmp." + host + "." + to_string(getpid());
+        ofstream out(temp_path, ios::binary | ios::trunc);
+        static const char padding[8] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        size_t written = sizeof(header);
+        for (unsigned s = 0; s < SECTION_COUNT; s++) {
+                out.write(padding, header.sections[s].offset - written);
+                size_t size = contents[s].second * SECTION_RECORD_SIZES[s];
+                out.write(static_cast<const char *>(contents[s].first), size);
+                written = header.sections[s].offset + size;
+        }
+        out.close();
+        if (!out || rename(temp_path.c_str(), path.c_str()) != 0) {
+                string error = strerror(errno);
+                remove(temp_path.c_str());
+                return error;
+        }
+        return "";
+}
+
+template <typename T>
+const T *SummaryStore::section(unsigned which) const {
+        return reinterpret_cast<const T *>(file.data() + header->sections[which].offset);
+}
+
+SummaryStore::SummaryStore(const string &path) : file(path) {
+        if (!file.ok()) {
+                failure = file.error();
+                return;
+        }
+        if (file.size() < sizeof(StoreHeader)) {
+                failure = "truncated header";
+                return;
+        }
+        // mappings are page aligned, so the records are aligned too.
+        header = reinterpret_cast<const StoreHeader *>(file.data());
+        if (memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) {
+                failure = "not a summary store";
+                return;
+        }
+        if (header->version != STORE_VERSION || header->num_sections != SECTION_COUNT) {
+                failure = "written by an incompatible version (" + to_string(header->version) + ")";
+                return;
+        }
+        failure = validate();
+        if (!failure.empty())
+                return;
+
+        const StoreDimension *stored = section<StoreDimension>(SECTION_DIMENSIONS);
+        for (uint64_t i = 0; i < header->sections[SECTION_DIMENSIONS].count; i++) {
+                Dimension d;
+                for (int j = 0; j < SI_BASE_UNITS_COUNT; j++)
+                        d.coefficients[j] = stored[i].coefficients[j];
+                d.scalar_numerator = stored[i].scalar_numerator;
+                d.scalar_denominator = stored[i].scalar_denominator;
+                dimensions.push_back(intern_dimension(d));
+        }
+}
+
+// Checks every index in the store once, so that the accessors need not.
+string SummaryStore::validate() const {
+        uint64_t count[SECTION_COUNT];
+        for (unsigned s = 0; s < SECTION_COUNT; s++) {
+                const StoreSection &section = header->sections[s];
+                count[s] = section.count;
+                if (section.offset % 8 != 0 || section.offset < sizeof(StoreHeader) ||
+                    section.offset > file.size() || section.count > UINT32_MAX ||
+                    section.count * SECTION_RECORD_SIZES[s] > file.size() - section.offset)
+                        return "section " + to_string(s) + " out of bounds";
+        }
+        auto in = [&count](const StoreRange &r, unsigned s) {
+                return static_cast<uint64_t>(r.begin) + r.count <= count[s];
+        };
+        auto is_string = [&count](uint32_t id) { return id < count[SECTION_STRINGS]; };
+        const uint32_t *ids = section<uint32_t>(SECTION_IDS);
+
+        const StoreString *strings = section<StoreString>(SECTION_STRINGS);
+        for (uint64_t i = 0; i < count[SECTION_STRINGS]; i++)
+                if (static_cast<uint64_t>(strings[i].offset) + strings[i].length > count[SECTION_STRING_DATA])
+                        return "string out of bounds";
+        const uint32_t *units = section<uint32_t>(SECTION_UNITS);
+        for (uint64_t i = 0; i < count[SECTION_UNITS]; i++)
+                if (!is_string(units[i]))
+                        return "unit name out of bounds";
+        const StoreUnit *tus = section<StoreUnit>(SECTION_TUS);
+        for (uint64_t i = 0; i < count[SECTION_TUS]; i++)
+                if (!is_string(tus[i].file) || !is_string(tus[i].key) ||
+                    !in(tus[i].functions, SECTION_FUNCTIONS) ||
+                    !in(tus[i].diagnostics, SECTION_DIAGNOSTICS))
+                        return "translation unit out of bounds";
+        const StoreFunction *functions = section<StoreFunction>(SECTION_FUNCTIONS);
+        for (uint64_t i = 0; i < count[SECTION_FUNCTIONS]; i++) {
+                const StoreFunction &fn = functions[i];
+                if (!is_string(fn.name) || fn.tu >= count[SECTION_TUS] ||
+                    !in(fn.callees, SECTION_IDS) || !in(fn.usrs, SECTION_IDS) ||
+                    !in(fn.contexts, SECTION_CONTEXTS) ||
+                    !in(fn.params, SECTION_PARAMS) || !in(fn.stores, SECTION_STORES))
+                        return "function out of bounds";
+                for (uint32_t j = 0; j < fn.callees.count; j++)
+                        if (!is_string(ids[fn.callees.begin + j]))
+                                return "callee out of bounds";
+                for (uint32_t j = 0; j < fn.usrs.count; j++)
+                        if (!is_string(ids[fn.usrs.begin + j]))
+                                return "USR out of bounds";
+        }
+        const uint32_t *name_index = section<uint32_t>(SECTION_NAME_INDEX);
+        if (count[SECTION_NAME_INDEX] != count[SECTION_FUNCTIONS])
+                return "name index does not cover the functions";
+        for (uint64_t i = 0; i < count[SECTION_NAME_INDEX]; i++)
+                if (name_index[i] >= count[SECTION_FUNCTIONS])
+                        return "name index out of bounds";
+        const StoreContext *contexts = section<StoreContext>(SECTION_CONTEXTS);
+        for (uint64_t i = 0; i < count[SECTION_CONTEXTS]; i++)
+                if (!is_string(contexts[i].callee) || !in(contexts[i].calls, SECTION_CALLS))
+                        return "calling context out of bounds";
+        const StoreRange *calls = section<StoreRange>(SECTION_CALLS);
+        for (uint64_t i = 0; i < count[SECTION_CALLS]; i++) {
+                if (!in(calls[i], SECTION_IDS))
+                        return "call out of bounds";
+                for (uint32_t j = 0; j < calls[i].count; j++)
+                        if (ids[calls[i].begin + j] >= count[SECTION_TYPES])
+                                return "argument type out of bounds";
+        }
+        const StoreParam *params = section<StoreParam>(SECTION_PARAMS);
+        for (uint64_t i = 0; i < count[SECTION_PARAMS]; i++)
+                if (params[i].kind > SOURCE_UNKNOWN)
+                        return "unknown parameter type source";
+        const StoreVariable *stores = section<StoreVariable>(SECTION_STORES);
+        for (uint64_t i = 0; i < count[SECTION_STORES]; i++)
+                if (!is_string(stores[i].name) || stores[i].type >= count[SECTION_TYPES])
+                        return "store out of bounds";
+        const StoreType *types = section<StoreType>(SECTION_TYPES);
+        for (uint64_t i = 0; i < count[SECTION_TYPES]; i++)
+                if (!in(types[i].frames, SECTION_INTS) || !in(types[i].units, SECTION_INTS) ||
+                    !in(types[i].sources, SECTION_SOURCES) || types[i].dimension < -1 ||
+                    types[i].dimension >= static_cast<int64_t>(count[SECTION_DIMENSIONS]))
+                        return "type out of bounds";
+        const StoreSource *sources = section<StoreSource>(SECTION_SOURCES);
+        for (uint64_t i = 0; i < count[SECTION_SOURCES]; i++)
+                if (sources[i].kind > SOURCE_UNKNOWN || !is_string(sources[i].var_name))
+                        return "type source out of bounds";
+        const StoreDiagnostic *diagnostics = section<StoreDiagnostic>(SECTION_DIAGNOSTICS);
+        for (uint64_t i = 0; i < count[SECTION_DIAGNOSTICS]; i++) {
+                const StoreDiagnostic &d = diagnostics[i];
+                if (d.kind > DIAG_UNIT_CONFLICT || !is_string(d.file) || !is_string(d.variable) ||
+                    !is_string(d.expected) || !is_string(d.actual) || !is_string(d.message) ||
+                    !in(d.trace, SECTION_IDS))
+                        return "diagnostic out of bounds";
+                for (uint32_t j = 0; j < d.trace.count; j++)
+                        if (!is_string(ids[d.trace.begin + j]))
+                                return "diagnostic trace out of bounds";
+        }
+        return "";
+}
+
+string_view SummaryStore::str(uint32_t id) const {
+        const StoreString &s = section<StoreString>(SECTION_STRINGS)[id];
+        return string_view(section<char>(SECTION_STRING_DATA) + s.offset, s.length);
+}
+
+TypeInfo SummaryStore::type(uint32_t id) const {
+        const StoreType &stored = section<StoreType>(SECTION_TYPES)[id];
+        const int32_t *ints = section<int32_t>(SECTION_INTS);
+        TypeInfo ti;
+        ti.frames.insert(ints + stored.frames.begin, ints + stored.frames.begin + stored.frames.count);
+        ti.units.insert(ints + stored.units.begin, ints + stored.units.begin + stored.units.count);
+        const StoreSource *sources = section<StoreSource>(SECTION_SOURCES) + stored.sources.begin;
+        for (uint32_t i = 0; i < stored.sources.count; i++)
+                ti.source.push_back({static_cast<TypeSourceKind>(sources[i].kind),
+                                     sources[i].param_no, string(str(sources[i].var_name))});
+        if (stored.dimension >= 0)
+                ti.dimension = dimensions[stored.dimension];
+        return ti;
+}
+
+vector<string> SummaryStore::unit_names() const {
+        vector<string> names;
+        const uint32_t *units = section<uint32_t>(SECTION_UNITS);
+        for (uint64_t i = 0; i < header->sections[SECTION_UNITS].count; i++)
+                names.emplace_back(str(units[i]));
+        return names;
+}
+
+unsigned SummaryStore::num_translation_units() const {
+        return header->sections[SECTION_TUS].count;
+}
+
+string_view SummaryStore::translation_unit_file(unsigned tu) const {
+        return str(section<StoreUnit>(SECTION_TUS)[tu].file);
+}
+
+string_view SummaryStore::translation_unit_key(unsigned tu) const {
+        return str(section<StoreUnit>(SECTION_TUS)[tu].key);
+}
+
+vector<Diagnostic> SummaryStore::diagnostics(unsigned tu) const {
+        const StoreRange &range = section<StoreUnit>(SECTION_TUS)[tu].diagnostics;
+        const StoreDiagnostic *stored = section<StoreDiagnostic>(SECTION_DIAGNOSTICS) + range.begin;
+        const uint32_t *ids = section<uint32_t>(SECTION_IDS);
+        vector<Diagnostic> result;
+        for (uint32_t i = 0; i < range.count; i++) {
+                Diagnostic d;
+                d.kind = static_cast<DiagnosticKind>(stored[i].kind);
+                d.file = str(stored[i].file);
+                d.line = stored[i].line;
+                d.variable = str(stored[i].variable);
+                d.expected = str(stored[i].expected);
+                d.actual = str(stored[i].actual);
+                d.message = str(stored[i].message);
+                for (uint32_t j = 0; j < stored[i].trace.count; j++)
+                        d.trace.emplace_back(str(ids[stored[i].trace.begin + j]));
+                result.push_back(move(d));
+        }
+        return result;
+}
+
+pair<size_t, size_t> SummaryStore::functions_of(unsigned tu) const {
+        const StoreRange &functions = section<StoreUnit>(SECTION_TUS)[tu].functions;
+        return {functions.begin, functions.begin + functions.count};
+}
+
+size_t SummaryStore::num_functions() const {
+        return header->sections[SECTION_FUNCTIONS].count;
+}
+
+string_view SummaryStore::function_name(size_t f) const {
+        return str(section<StoreFunction>(SECTION_FUNCTIONS)[f].name);
+}
+
+unsigned SummaryStore::function_tu(size_t f) const {
+        return section<StoreFunction>(SECTION_FUNCTIONS)[f].tu;
+}
+
+vector<size_t> SummaryStore::find(string_view name) const {
+        const uint32_t *first = section<uint32_t>(SECTION_NAME_INDEX);
+        const uint32_t *last = first + header->sections[SECTION_NAME_INDEX].count;
+        const uint32_t *it = lower_bound(first, last, name, [this](uint32_t f, string_view n) {
+                return function_name(f) < n;
+        });
+        vector<size_t> found;
+        for (; it != last && function_name(*it) == name; it++)
+                found.push_back(*it);
+        return found;
+}
+
+FunctionSummary SummaryStore::summary(size_t f) const {
+        const StoreFunction &fn = section<StoreFunction>(SECTION_FUNCTIONS)[f];
+        const uint32_t *ids = section<uint32_t>(SECTION_IDS);
+        FunctionSummary summary;
+        summary.num_params = fn.num_params;
+        for (uint32_t i = 0; i < fn.callees.count; i++)
+                summary.callees.emplace(str(ids[fn.callees.begin + i]));
+        for (uint32_t i = 0; i < fn.usrs.count; i++)
+                summary.usrs.emplace(str(ids[fn.usrs.begin + i]));
+
+        const StoreContext *contexts = section<StoreContext>(SECTION_CONTEXTS) + fn.contexts.begin;
+        const StoreRange *calls = section<StoreRange>(SECTION_CALLS);
+        for (uint32_t i = 0; i < fn.contexts.count; i++) {
+                auto &context = summary.calling_context[string(str(contexts[i].callee))];
+                for (uint32_t j = 0; j < contexts[i].calls.count; j++) {
+                        const StoreRange &call = calls[contexts[i].calls.begin + j];
+                        vector<TypeInfo> args;
+                        for (uint32_t k = 0; k < call.count; k++)
+                                args.push_back(type(ids[call.begin + k]));
+                        context.push_back(move(args));
+                }
+        }
+
+        const StoreParam *params = section<StoreParam>(SECTION_PARAMS) + fn.params.begin;
+        for (uint32_t i = 0; i < fn.params.count; i++)
+                summary.param_to_typesource_kind.emplace(params[i].param,
+                                                         static_cast<TypeSourceKind>(params[i].kind));
+
+        const StoreVariable *stores = section<StoreVariable>(SECTION_STORES) + fn.stores.begin;
+        for (uint32_t i = 0; i < fn.stores.count; i++)
+                summary.store_to_typeinfo.emplace(str(stores[i].name), type(stores[i].type));
+        return summary;
+}
+
+void SummaryStore::load_translation_unit(unsigned tu, unsigned target,
+                                         vector<map<string, FunctionSummary>> &fn_summaries,
+                                         unordered_map<string, set<unsigned>> &name_to_tu,
+                                         set<string> &functions_with_intrinsic_variables,
+                                         unordered_set<string> &seen_definitions) const {
+        pair<size_t, size_t> functions = functions_of(tu);
+        for (size_t f = functions.first; f < functions.second; f++) {
+                string name(function_name(f));
+                FunctionSummary loaded = summary(f);
+                uint32_t flags = section<StoreFunction>(SECTION_FUNCTIONS)[f].flags;
+                // a definition that another TU has is only kept for this
+                // TU's own store.
+                bool claimed = false;
+                for (const auto &usr : loaded.usrs)
+                        claimed |= seen_definitions.insert(usr).second;
+                if ((flags & FUNCTION_DEFINED) && claimed) {
+                        name_to_tu[name].insert(target);
+                        if (flags & FUNCTION_INTRINSIC)
+                                functions_with_intrinsic_variables.insert(name);
+                }
+                fn_summaries[target][name] = move(loaded);
+        }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+#include "diagnostics.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+// The records of a summary store, defined in summary_store.cpp.
+struct StoreHeader;
+
+// A translation unit of a summary store.
+struct StoredUnit {
+        // its TU number in the analysis that wrote it
+        unsigned tu;
+
+        // its main file
+        string file;
+
+        // identifies the command it was compiled with; two commands for the
+        // same file but different flags have different keys.
+        string key;
+};
+
+// The summaries of one analysis run, as the analysis keeps them.
+struct SummarySnapshot {
+        // the translation units to write
+        vector<StoredUnit> translation_units;
+
+        // fn_summaries[tu] maps the functions of TU tu to their summaries
+        const vector<map<string, FunctionSummary>> &fn_summaries;
+
+        // the functions that store to variables with prior types
+        const set<string> &functions_with_intrinsic_variables;
+
+        // parse_diagnostics[tu] are the findings of parsing TU tu
+        const vector<vector<Diagnostic>> &parse_diagnostics;
+
+        // the unit names, by unit ID
+        vector<string> unit_names;
+};
+
+// Writes snapshot to path. Returns an empty string on success, or else why
+// it failed.
+string write_summary_store(const string &path, const SummarySnapshot &snapshot);
+
+/**
+ * A memory-mapped summary store.
+ *
+ * A store keeps the function summaries of a run in flat arrays: every
+ * string and every distinct TypeInfo is stored once and referred to by
+ * index, and calling contexts are ranges of such indices. Names, TUs and
+ * lookups by name read the mapping directly; summary() builds a
+ * FunctionSummary only for the function asked for.
+ *
+ * The analysis itself still keeps its summaries in fn_summaries, so it
+ * loads whole TUs with load_translation_unit(), which decodes every
+ * function of the TU. A warm start thus saves parsing, but not the memory
+ * or the decoding of the summaries it uses.
+ *
+ * Unit IDs only mean something for the units a store was written with, so
+ * readers compare unit_names() with their own before using its types.
+ */
+class SummaryStore {
+      public:
+        // Maps the store at path. If it is not a valid store, error() says
+        // why.
+        explicit SummaryStore(const string &path);
+
+        bool ok() const { return failure.empty(); }
+        const string &error() const { return failure; }
+
+        // Returns the unit names the store was written with, by unit ID.
+        vector<string> unit_names() const;
+
+        unsigned num_translation_units() const;
+        string_view translation_unit_file(unsigned tu) const;
+        string_view translation_unit_key(unsigned tu) const;
+
+        // Returns the findings of parsing stored TU tu.
+        vector<Diagnostic> diagnostics(unsigned tu) const;
+
+        // Returns the functions of stored TU tu, as [first, last).
+        pair<size_t, size_t> functions_of(unsigned tu) const;
+
+        size_t num_functions() const;
+        string_view function_name(size_t f) const;
+        unsigned function_tu(size_t f) const;
+
+        // Returns the functions named name, in TU order.
+        vector<size_t> find(string_view name) const;
+
+        // Returns the summary of function f.
+        FunctionSummary summary(size_t f) const;
+
+        // Decodes the functions of stored TU tu into the analysis state as
+        // TU target. A function is only added to name_to_tu if one of its
+        // definitions is not in seen_definitions yet, which it adds them to.
+        void load_translation_unit(unsigned tu, unsigned target,
+                                   vector<map<string, FunctionSummary>> &fn_summaries,
+                                   unordered_map<string, set<unsigned>> &name_to_tu,
+                                   set<string> &functions_with_intrinsic_variables,
+                                   unordered_set<string> &seen_definitions) const;
+
+      private:
+        string validate() const;
+        string_view str(uint32_t id) const;
+        TypeInfo type(uint32_t id) const;
+
+        template <typename T>
+        const T *section(unsigned which) const;
+
+        MappedFile file;
+        string failure;
+        const StoreHeader *header = nullptr;
+
+        // the stored dimensions, interned in this process
+        vector<DimensionId> dimensions;
+};
@@ -1,13 +1,345 @@
+#include <cctype>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include "units.hpp"
 
+// Returns a dimension with the given exponents of m, s, g, A, K, mol and cd,
+// scaled by numerator / denominator.
+static Dimension make_dimension(array<int, SI_BASE_UNITS_COUNT> coefficients, int64_t numerator = 1, int64_t denominator = 1) {
+    Dimension d = {
+        .coefficients = coefficients,
+        .scalar_numerator = 1,
+        .scalar_denominator = 1,
+    };
+    d.set_scalar(numerator, denominator, 1, 1);
+    return d;
+}
+
+static const Dimension dimensionless = make_dimension({0, 0, 0, 0, 0, 0, 0});
+static const Dimension second = make_dimension({0, 1, 0, 0, 0, 0, 0});
+static const Dimension kilogram = make_dimension({0, 0, 1, 0, 0, 0, 0}, 1000);
+static const Dimension ampere = make_dimension({0, 0, 0, 1, 0, 0, 0});
+static const Dimension newton = make_dimension({1, -2, 1, 0, 0, 0, 0}, 1000);
+static const Dimension joule = newton * make_dimension({1, 0, 0, 0, 0, 0, 0});
+static const Dimension watt = joule / second;
+static const Dimension volt = watt / ampere;
+static const Dimension tesla = kilogram / (ampere * second * second);
+// pi ~= 355/113, so 1 deg = pi/180 rad ~= 355/20340.
+static const Dimension degree = make_dimension({0, 0, 0, 0, 0, 0, 0}, 355, 20340);
+
+// Relates unit symbols and names to their dimensions.
+static const map<string, Dimension> unit_dimensions = {
+    {"m", make_dimension({1, 0, 0, 0, 0, 0, 0})},
+    {"meter", make_dimension({1, 0, 0, 0, 0, 0, 0})},
+    {"meters", make_dimension({1, 0, 0, 0, 0, 0, 0})},
+    {"s", second},
+    {"sec", second},
+    {"second", second},
+    {"seconds", second},
+    {"min", make_dimension({0, 1, 0, 0, 0, 0, 0}, 60)},
+    {"h", make_dimension({0, 1, 0, 0, 0, 0, 0}, 3600)},
+    {"Ah", ampere * make_dimension({0, 1, 0, 0, 0, 0, 0}, 3600)},
+    {"g", make_dimension({0, 0, 1, 0, 0, 0, 0})},
+    {"gram", make_dimension({0, 0, 1, 0, 0, 0, 0})},
+    {"A", ampere},
+    {"K", make_dimension({0, 0, 0, 0, 1, 0, 0})},
+    // the offset from kelvin is ignored.
+    {"degC", make_dimension({0, 0, 0, 0, 1, 0, 0})},
+    {"mol", make_dimension({0, 0, 0, 0, 0, 1, 0})},
+    {"cd", make_dimension({0, 0, 0, 0, 0, 0, 1})},
+    {"Hz", dimensionless / second},
+    {"N", newton},
+    {"Pa", newton / make_dimension({2, 0, 0, 0, 0, 0, 0})},
+    {"J", joule},
+    {"W", watt},
+    {"V", volt},
+    {"Volt", volt},
+    {"T", tesla},
+    {"gauss", tesla * make_dimension({0, 0, 0, 0, 0, 0, 0}, 1, 10000)},
+    {"G", tesla * make_dimension({0, 0, 0, 0, 0, 0, 0}, 1, 10000)},
+    {"rad", dimensionless},
+    {"radian", dimensionless},
+    {"radians", dimensionless},
+    {"deg", degree},
+    {"degree", degree},
+    {"degrees", degree},
+    // one revolution is 2 pi rad.
+    {"rpm", make_dimension({0, -1, 0, 0, 0, 0, 0}, 710, 113 * 60)},
+    {"%", make_dimension({0, 0, 0, 0, 0, 0, 0}, 1, 100)},
+    {"percent", make_dimension({0, 0, 0, 0, 0, 0, 0}, 1, 100)},
+};
+
+// Relates SI prefixes to the power of 10 they scale by.
+static const map<string, int> prefix_exponents = {
+    {"G", 9}, {"M", 6}, {"k", 3}, {"h", 2}, {"da", 1},
+    {"d", -1}, {"c", -2}, {"m", -3}, {"u", -6}, {"n", -9},
+    {"giga", 9}, {"mega", 6}, {"kilo", 3}, {"hecto", 2}, {"deca", 1},
+    {"deci", -1}, {"centi", -2}, {"milli", -3}, {"micro", -6}, {"nano", -9},
+};
+
+// Returns d scaled by 10^exponent.
+static Dimension scale(const Dimension &d, int exponent) {
+    int64_t factor = 1;
+    for (int i = 0; i < abs(exponent); i++)
+        factor *= 10;
+    return d * (exponent >= 0 ? make_dimension({0, 0, 0, 0, 0, 0, 0}, factor)
+                              : make_dimension({0, 0, 0, 0, 0, 0, 0}, 1, factor));
+}
+
+// Returns d raised to power.
+static Dimension power(const Dimension &d, int power) {
+    Dimension result = dimensionless;
+    for (int i = 0; i < abs(power); i++)
+        result = power >= 0 ? result * d : result / d;
+    return result;
+}
+
+// Looks up a unit name, possibly with an SI prefix.
+static optional<Dimension> lookup_unit(const string &name) {
+    const auto &it = unit_dimensions.find(name);
+    if (it != unit_dimensions.end())
+        return it->second;
+    for (const auto &prefix : prefix_exponents) {
+        if (name.size() > prefix.first.size() && name.compare(0, prefix.first.size(), prefix.first) == 0) {
+            const auto &unit = unit_dimensions.find(name.substr(prefix.first.size()));
+            if (unit != unit_dimensions.end())
+                return scale(unit->second, prefix.second);
+        }
+    }
+    return {};
+}
+
+static const int MAX_EXPONENT = 99;
+
+// Parses unit expressions; see string_to_dimension for the grammar.
+class UnitParser {
+public:
+    explicit UnitParser(const string &s) : s(s), pos(0) {}
+
+    optional<Dimension> parse() {
+        optional<Dimension> d = expression();
+        skip_spaces();
+        if (pos != s.size() || (d && d->overflowed))
+            return {};
+        return d;
+    }
+
+private:
+    // expression := factor (('*' | '.' | ' ' | '/') factor)*
+    optional<Dimension> expression() {
+        optional<Dimension> result = factor();
+        while (result) {
+            skip_spaces();
+            if (pos >= s.size() || s[pos] == ')')
+                break;
+            char op = s[pos];
+            if (op == '*' || op == '/' || op == '.')
+                pos++;
+            optional<Dimension> rhs = factor();
+            if (!rhs)
+                return {};
+            result = op == '/' ? result.value() / rhs.value() : result.value() * rhs.value();
+        }
+        return result;
+    }
+
+    // factor := (number | unit | '(' expression ')') ['^' integer]
+    optional<Dimension> factor() {
+        skip_spaces();
+        optional<Dimension> result;
+        if (pos < s.size() && isdigit(s[pos])) {
+            int64_t value = 0;
+            while (pos < s.size() && isdigit(s[pos])) {
+                if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, s[pos++] - '0', &value))
+                    return {};
+            }
+            // a factor applied to the value, like the E<n> suffix.
+            result = numeric_factor_dimension(value);
+        } else if (pos < s.size() && s[pos] == '(') {
+            pos++;
+            result = expression();
+            if (!result || pos >= s.size() || s[pos] != ')')
+                return {};
+            pos++;
+        } else {
+            result = unit();
+        }
+        if (result && pos < s.size() && s[pos] == '^') {
+            pos++;
+            optional<int> exponent = integer();
+            if (!exponent)
+                return {};
+            result = power(result.value(), exponent.value());
+        }
+        return result;
+    }
+
+    // unit := name ['E' integer]
+    optional<Dimension> unit() {
+        size_t start = pos;
+        while (pos < s.size() && (isalpha(s[pos]) || s[pos] == '%'))
+            pos++;
+        string name = s.substr(start, pos - start);
+        if (name.empty())
+            return {};
+
+        // e.g. degE7 is deg * 10^-7.
+        int exponent = 0;
+        if (name.size() > 1 && name.back() == 'E' && pos < s.size() && (isdigit(s[pos]) || s[pos] == '-')) {
+            name.pop_back();
+            optional<int> e = integer();
+            if (!e)
+                return {};
+            exponent = -e.value();
+        }
+
+        optional<Dimension> d = lookup_unit(name);
+        if (!d)
+            return {};
+        return exponent ? scale(d.value(), exponent) : d;
+    }
+
+    optional<int> integer() {
+        bool negative = pos < s.size() && s[pos] == '-';
+        if (negative)
+            pos++;
+        if (pos >= s.size() || !isdigit(s[pos]))
+            return {};
+        int value = 0;
+        while (pos < s.size() && isdigit(s[pos])) {
+            value = value * 10 + (s[pos++] - '0');
+            // no unit has a larger exponent; this also bounds power().
+            if (value > MAX_EXPONENT)
+                return {};
+        }
+        return negative ? -value : value;
+    }
+
+    void skip_spaces() {
+        while (pos < s.size() && s[pos] == ' ')
+            pos++;
+    }
+
+    const string &s;
+    size_t pos;
+};
+
+static unordered_map<string, optional<DimensionId>> parsed_units;
+static mutex parsed_units_lock;
+
+struct DimensionHash {
+    size_t operator()(const Dimension &d) const {
+        size_t hash = static_cast<size_t>(d.scalar_numerator) * 31 + static_cast<size_t>(d.scalar_denominator);
+        for (int c : d.coefficients)
+            hash = hash * 31 + c;
+        return hash;
+    }
+};
+
+// Interned dimensions, indexed by ID; a deque never moves its elements.
+static deque<Dimension> dimensions;
+static unordered_map<Dimension, DimensionId, DimensionHash> dimension_ids;
+static shared_mutex dimensions_lock;
+
+// Memoized arithmetic, keyed by the operands' IDs. A codebase has few
+// distinct dimensions, so these stay small.
+static unordered_map<uint64_t, optional<DimensionId>> products, quotients;
+static shared_mutex arithmetic_lock;
+
+DimensionId intern_dimension(const Dimension &d) {
+    {
+        shared_lock<shared_mutex> guard(dimensions_lock);
+        const auto &it = dimension_ids.find(d);
+        if (it != dimension_ids.end())
+            return it->second;
+    }
+    unique_lock<shared_mutex> guard(dimensions_lock);
+    const auto &it = dimension_ids.emplace(d, dimensions.size());
+    if (it.second)
+        dimensions.push_back(d);
+    return it.first->second;
+}
+
+const Dimension &get_dimension(DimensionId id) {
+    shared_lock<shared_mutex> guard(dimensions_lock);
+    return dimensions[id];
+}
+
+// Returns the memoized result of op on a and b.
+template <typename Op>
+static optional<DimensionId> memoized(unordered_map<uint64_t, optional<DimensionId>> &results, DimensionId a, DimensionId b, Op op) {
+    uint64_t key = (static_cast<uint64_t>(a) << 32) | static_cast<uint32_t>(b);
+    {
+        shared_lock<shared_mutex> guard(arithmetic_lock);
+        const auto &it = results.find(key);
+        if (it != results.end())
+            return it->second;
+    }
+    Dimension d = op(get_dimension(a), get_dimension(b));
+    optional<DimensionId> result;
+    if (!d.overflowed)
+        result = intern_dimension(d);
+    unique_lock<shared_mutex> guard(arithmetic_lock);
+    results.emplace(key, result);
+    return result;
+}
+
+optional<DimensionId> multiply_dimensions(DimensionId a, DimensionId b) {
+    return memoized(products, a, b, [](const Dimension &l, const Dimension &r) { return l * r; });
+}
+
+optional<DimensionId> divide_dimensions(DimensionId a, DimensionId b) {
+    return memoized(quotients, a, b, [](const Dimension &l, const Dimension &r) { return l / r; });
+}
+
+// Returns the dimension of the unitless numeric factor numerator / denominator.
+// Multiplying a value by k divides its unit by k, e.g. meters * 100 are centimeters.
+Dimension numeric_factor_dimension(int64_t numerator, int64_t denominator) {
+    if (numerator == 0 || denominator == 0) {
+        return make_dimension({0, 0, 0, 0, 0, 0, 0});
+    }
+    return make_dimension({0, 0, 0, 0, 0, 0, 0}, llabs(denominator), llabs(numerator));
+}
+
+// Returns the ID of the dimension of spelling, if it has one.
+optional<DimensionId> string_to_dimension_id(const string &spelling) {
+    lock_guard<mutex> guard(parsed_units_lock);
+    const auto &it = parsed_units.find(spelling);
+    if (it != parsed_units.end()) {
+        return it->second;
+    }
+    optional<Dimension> d = UnitParser(spelling).parse();
+    optional<DimensionId> id;
+    if (d) {
+        id = intern_dimension(d.value());
+    }
+    parsed_units.emplace(spelling, id);
+    return id;
+}
+
 // Try to convert spelling into a dimension.
 optional<Dimension> string_to_dimension(const string &spelling) {
-    if (unit_name_to_coefficients.find(spelling) != unit_name_to_coefficients.end()) {
-        return unit_name_to_coefficients.at(spelling);
+    optional<DimensionId> id = string_to_dimension_id(spelling);
+    if (id) {
+        return get_dimension(id.value());
     }
     return {};
 }
 
+// Returns the dimension of each unit ID, indexed by ID.
+vector<optional<DimensionId>> get_unit_dimensions(const map<string, int> &unitname_to_id, int num_units) {
+    vector<optional<DimensionId>> unit_dimensions(num_units);
+    for (const auto &unit : unitname_to_id) {
+        if (unit.second >= 0 && unit.second < num_units) {
+            unit_dimensions[unit.second] = string_to_dimension_id(unit.first);
+        }
+    }
+    return unit_dimensions;
+}
+
 
 ostream& operator<<(ostream &o, const Dimension &d) {
     string sep = "";
@@ -17,4 +349,4 @@ ostream& operator<<(ostream &o, const Dimension &d) {
         sep = ", ";
     }
     return o << "]";
-}
\ No newline at end of file
+}
@@ -2,19 +2,48 @@
 
 #include <map>
 #include <optional>
+#include <vector>
 
 #include "common.hpp"
 
-const Dimension centimeter = {.coefficients = {1, 0, 0, 0, 0, 0, 0}, .scalar_numerator = 1, .scalar_denominator = 100};
-const Dimension meter = {.coefficients = {1, 0, 0, 0, 0, 0, 0}, .scalar_numerator = 1, .scalar_denominator = 1};
+// Returns the dimension of the unitless numeric factor numerator / denominator.
+// Multiplying a value by k divides its unit by k, e.g. meters * 100 are centimeters.
+Dimension numeric_factor_dimension(int64_t numerator, int64_t denominator = 1);
 
-static const map<string, Dimension> unit_name_to_coefficients = {
-    {"centimeter", centimeter},
-    {"meter", meter},
-    // TODO: fill in with other units!
-};
-
-// Try to convert spelling into a dimension.
+/**
+ * Try to convert spelling into a dimension.
+ *
+ * Spellings are unit expressions as written in MAVLink and LMCP message
+ * definitions: SI symbols or names with optional prefixes (cm, mrad,
+ * millisecond), joined by * or . and / (m/s/s, A.h), with integer powers
+ * (cm^3) and numeric factors. As in MAVLink, a factor describes how the value
+ * was scaled, so m/s*5 is in units of 1/5 m/s, and degE7 (deg * 10^7) is in
+ * units of 10^-7 deg. Degrees use pi ~= 355/113, and temperatures
+ * in degC are treated as kelvin with the offset ignored. Units that are not
+ * physical quantities (bytes, dB, pix) have no dimension.
+ *
+ * Results are memoized per spelling.
+ */
 optional<Dimension> string_to_dimension(const string &spelling);
 
-ostream& operator<<(ostream &o, const Dimension &d);
\ No newline at end of file
+// Returns the dimension of each unit ID, indexed by ID.
+vector<optional<DimensionId>> get_unit_dimensions(const map<string, int> &unitname_to_id, int num_units);
+
+// Returns the ID of d, interning it if it is new.
+DimensionId intern_dimension(const Dimension &d);
+
+// Returns the dimension with the given ID.
+const Dimension &get_dimension(DimensionId id);
+
+// Returns the ID of get_dimension(a) * get_dimension(b), unless its scalar
+// overflows.
+optional<DimensionId> multiply_dimensions(DimensionId a, DimensionId b);
+
+// Returns the ID of get_dimension(a) / get_dimension(b), unless its scalar
+// overflows.
+optional<DimensionId> divide_dimensions(DimensionId a, DimensionId b);
+
+// Returns the ID of the dimension of spelling, if it has one.
+optional<DimensionId> string_to_dimension_id(const string &spelling);
+
+ostream& operator<<(ostream &o, const Dimension &d);
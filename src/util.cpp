@@ -1,5 +1,16 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
 #include "util.hpp"
 
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
 extern "C" {
 #include "clang-c/CXString.h"
 #include "clang-c/Index.h"
@@ -49,6 +60,22 @@ string get_USR(CXCursor c) {
         return result;
 }
 
+// returns the cursor's spelling qualified by the namespaces and classes
+// declaring it, e.g. AP_GPS::update
+string get_qualified_name(CXCursor c) {
+        string result = get_cursor_spelling(c);
+        for (CXCursor parent = clang_getCursorSemanticParent(c);
+             !clang_Cursor_isNull(parent) && !clang_isTranslationUnit(clang_getCursorKind(parent)) &&
+             !clang_isInvalid(clang_getCursorKind(parent));
+             parent = clang_getCursorSemanticParent(parent)) {
+                // anonymous namespaces have no name
+                string scope = get_cursor_spelling(parent);
+                if (!scope.empty())
+                        result = scope + "::" + result;
+        }
+        return result;
+}
+
 // changes the current working directory only for the calling thread
 int change_thread_working_dir(const char *dirname) {
         int result;
@@ -65,6 +92,84 @@ int change_thread_working_dir(const char *dirname) {
         return result;
 }
 
+static enum CXChildVisitResult count_left_tokens(CXCursor c, CXCursor,
+                                                 CXClientData cd) {
+        unsigned *count = static_cast<unsigned *>(cd);
+        CXTranslationUnit unit = clang_Cursor_getTranslationUnit(c);
+        CXSourceRange range = clang_getCursorExtent(c);
+        CXToken *tokens;
+        clang_tokenize(unit, range, &tokens, count);
+        clang_disposeTokens(unit, tokens, *count);
+        return CXChildVisit_Break;
+}
+
+// Returns the binary operator at cursor.
+// How this is accomplished:
+//   A binary operator has two children.
+//   We count the number of tokens of the left child,
+//   so then the next token must be the operator.
+string get_binary_operator(CXCursor cursor) {
+        unsigned left_tokens;
+        clang_visitChildren(cursor, count_left_tokens, &left_tokens);
+
+        CXTranslationUnit unit = clang_Cursor_getTranslationUnit(cursor);
+        CXSourceRange range = clang_getCursorExtent(cursor);
+        CXToken *tokens;
+        unsigned count;
+        clang_tokenize(unit, range, &tokens, &count);
+
+        string result;
+        if (left_tokens < count) {
+                CXString token_spelling =
+                    clang_getTokenSpelling(unit, tokens[left_tokens]);
+                result = string(clang_getCString(token_spelling));
+                clang_disposeString(token_spelling);
+        }
+
+        clang_disposeTokens(unit, tokens, count);
+
+        return result;
+}
+
+// Returns the unary operator at cursor.
+// The operator is the first token, or the last one for postfix operators.
+string get_unary_operator(CXCursor cursor) {
+        CXTranslationUnit unit = clang_Cursor_getTranslationUnit(cursor);
+        CXSourceRange range = clang_getCursorExtent(cursor);
+        CXToken *tokens;
+        unsigned count;
+        clang_tokenize(unit, range, &tokens, &count);
+
+        string result;
+        if (count > 0) {
+                CXString token_spelling = clang_getTokenSpelling(unit, tokens[0]);
+                result = string(clang_getCString(token_spelling));
+                clang_disposeString(token_spelling);
+                if (clang_getTokenKind(tokens[0]) != CXToken_Punctuation) {
+                        token_spelling = clang_getTokenSpelling(unit, tokens[count - 1]);
+                        result = string(clang_getCString(token_spelling));
+                        clang_disposeString(token_spelling);
+                }
+        }
+
+        clang_disposeTokens(unit, tokens, count);
+
+        return result;
+}
+
+// Returns the children of cursor.
+vector<CXCursor> get_children(CXCursor cursor) {
+        vector<CXCursor> children;
+        clang_visitChildren(
+            cursor,
+            [](CXCursor c, CXCursor, CXClientData cd) {
+                    static_cast<vector<CXCursor> *>(cd)->push_back(c);
+                    return CXChildVisit_Continue;
+            },
+            &children);
+        return children;
+}
+
 // Inverts the map by mapping each value to its key.
 map<int, string> invert_map(map<string, int> &m) {
         map<int, string> result;
@@ -75,14 +180,16 @@ map<int, string> invert_map(map<string, int> &m) {
 }
 
 // Returns the GCD of the parameters.
-int gcd(int a, int b) {
+int64_t gcd(int64_t a, int64_t b) {
+        a = a < 0 ? -a : a;
+        b = b < 0 ? -b : b;
         if (a == 0 || b == 0) {
                 return max(a, b);
         }
 
-        int greatest = max(a, b);
-        int smallest = min(a, b);
-        int remainder = greatest % smallest;
+        int64_t greatest = max(a, b);
+        int64_t smallest = min(a, b);
+        int64_t remainder = greatest % smallest;
         while (remainder) {
                 greatest = smallest;
                 smallest = remainder;
@@ -90,3 +197,168 @@ int gcd(int a, int b) {
         }
         return smallest;
 }
+
+// Returns if text matches the glob pattern, where * matches any run of
+// characters and ? matches any one character.
+bool glob_match(string_view pattern, string_view text) {
+        size_t p = 0, t = 0;
+        // where to resume after the last *, if the match after it fails.
+        size_t star = string_view::npos, star_t = 0;
+        while (t < text.size()) {
+                if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+                        p++;
+                        t++;
+                } else if (p < pattern.size() && pattern[p] == '*') {
+                        star = p++;
+                        star_t = t;
+                } else if (star != string_view::npos) {
+                        p = star + 1;
+                        t = ++star_t;
+                } else {
+                        return false;
+                }
+        }
+        while (p < pattern.size() && pattern[p] == '*')
+                p++;
+        return p == pattern.size();
+}
+
+// Returns the 64-bit FNV-1a hash of the bytes, perturbed by seed.
+uint64_t fnv1a(const char *data, size_t len, uint64_t seed) {
+        uint64_t hash = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+        for (size_t i = 0; i < len; i++) {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 0x100000001b3ULL;
+        }
+        return hash;
+}
+
+static const uint32_t SHA256_K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotate_right(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256() {
+        static const uint32_t initial[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+        memcpy(state, initial, sizeof(state));
+}
+
+void Sha256::compress(const uint8_t *block) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+                w[i] = static_cast<uint32_t>(block[4 * i]) << 24 | static_cast<uint32_t>(block[4 * i + 1]) << 16 |
+                       static_cast<uint32_t>(block[4 * i + 2]) << 8 | block[4 * i + 3];
+        for (int i = 16; i < 64; i++) {
+                uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+                uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+                uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+                uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+                uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+}
+
+void Sha256::update(const void *data, size_t len) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        size_t used = length % 64;
+        length += len;
+        if (used) {
+                size_t n = min(len, 64 - used);
+                memcpy(buffer + used, bytes, n);
+                bytes += n;
+                len -= n;
+                if (used + n < 64)
+                        return;
+                compress(buffer);
+        }
+        for (; len >= 64; bytes += 64, len -= 64)
+                compress(bytes);
+        memcpy(buffer, bytes, len);
+}
+
+Sha256::Digest Sha256::digest() {
+        uint64_t bits = length * 8;
+        static const uint8_t padding[64] = {0x80};
+        update(padding, 1 + (119 - length % 64) % 64);
+        uint8_t encoded_bits[8];
+        for (int i = 0; i < 8; i++)
+                encoded_bits[i] = bits >> (56 - 8 * i);
+        update(encoded_bits, sizeof(encoded_bits));
+
+        Digest result;
+        for (int i = 0; i < 8; i++)
+                for (int j = 0; j < 4; j++)
+                        result[4 * i + j] = state[i] >> (24 - 8 * j);
+        return result;
+}
+
+string Sha256::hex(const Digest &digest) {
+        static const char digits[] = "0123456789abcdef";
+        string result;
+        for (uint8_t byte : digest) {
+                result += digits[byte >> 4];
+                result += digits[byte & 15];
+        }
+        return result;
+}
+
+MappedFile::MappedFile(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+                failure = strerror(errno);
+                return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+                failure = strerror(errno);
+        } else if (st.st_size > 0) {
+                // mmap rejects empty mappings, so an empty file stays unmapped.
+                void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                        failure = strerror(errno);
+                } else {
+                        contents = static_cast<const char *>(p);
+                        length = st.st_size;
+                        madvise(p, length, MADV_SEQUENTIAL);
+                }
+        }
+        close(fd);
+}
+
+MappedFile::~MappedFile() {
+        if (contents)
+                munmap(const_cast<char *>(contents), length);
+}
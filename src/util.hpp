@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <map>
+#include <vector>
 
 extern "C" {
 #include <clang-c/Index.h>
@@ -19,11 +24,91 @@ string get_cursor_spelling(CXCursor);
 // returns the unified symbol reference for the cursor
 string get_USR(CXCursor);
 
+// returns the cursor's spelling qualified by the namespaces and classes
+// declaring it, e.g. AP_GPS::update
+string get_qualified_name(CXCursor);
+
 // changes the current working directory only for the calling thread
 int change_thread_working_dir(const char *);
 
 // Returns the gcd of the parameters.
-int gcd(int, int);
+int64_t gcd(int64_t, int64_t);
 
 // Inverts the map by mapping each value to its key.
-map<int, string> invert_map(map<string, int> &m);
\ No newline at end of file
+map<int, string> invert_map(map<string, int> &m);
+
+// Returns if text matches the glob pattern, where * matches any run of
+// characters and ? matches any one character.
+bool glob_match(string_view pattern, string_view text);
+
+// Returns the 64-bit FNV-1a hash of the bytes, perturbed by seed.
+uint64_t fnv1a(const char *data, size_t len, uint64_t seed = 0);
+
+// Computes SHA-256 digests, for names that must not collide, e.g. of
+// entries in a cache shared between machines.
+class Sha256 {
+      public:
+        typedef array<uint8_t, 32> Digest;
+
+        Sha256();
+
+        // Hashes the next len bytes at data.
+        void update(const void *data, size_t len);
+
+        // Returns the digest of the bytes hashed so far. Nothing may be
+        // hashed afterwards.
+        Digest digest();
+
+        // Returns digest as 64 hex digits.
+        static string hex(const Digest &digest);
+
+      private:
+        void compress(const uint8_t *block);
+
+        uint32_t state[8];
+        uint8_t buffer[64];
+        uint64_t length = 0;
+};
+
+// Returns the children of cursor.
+vector<CXCursor> get_children(CXCursor cursor);
+
+// Returns the binary operator at cursor, e.g. "*".
+string get_binary_operator(CXCursor cursor);
+
+// Returns the unary operator at cursor, e.g. "-".
+string get_unary_operator(CXCursor cursor);
+
+// A read-only memory map of a whole file.
+class MappedFile {
+      public:
+        // Maps the file at path. If that fails, error() says why.
+        explicit MappedFile(const string &path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool ok() const { return failure.empty(); }
+        const string &error() const { return failure; }
+
+        const char *data() const { return contents; }
+        size_t size() const { return length; }
+
+      private:
+        const char *contents = nullptr;
+        size_t length = 0;
+        string failure;
+};
+
+// Hashes cursors, for use as unordered container keys.
+struct CursorHash {
+        size_t operator()(const CXCursor &c) const { return clang_hashCursor(c); }
+};
+
+// Compares cursors, for use as unordered container keys.
+struct CursorEqual {
+        bool operator()(const CXCursor &a, const CXCursor &b) const {
+                return clang_equalCursors(a, b);
+        }
+};
@@ -0,0 +1,78 @@
+#include "writer.hpp"
+
+AsyncLineWriter::AsyncLineWriter(const string &path, bool unique)
+    : file(path, ios::trunc), out(&file), unique(unique) {
+        if (file)
+                writer = thread(&AsyncLineWriter::run, this);
+}
+
+AsyncLineWriter::AsyncLineWriter(ostream &stream, bool unique, mutex *stream_lock)
+    : out(&stream), stream_lock(stream_lock), unique(unique) {
+        writer = thread(&AsyncLineWriter::run, this);
+}
+
+AsyncLineWriter::~AsyncLineWriter() {
+        close();
+}
+
+void AsyncLineWriter::submit(vector<string> &&lines) {
+        {
+                lock_guard<mutex> guard(queue_lock);
+                queue.push_back(move(lines));
+        }
+        queue_ready.notify_one();
+}
+
+void AsyncLineWriter::close() {
+        {
+                lock_guard<mutex> guard(queue_lock);
+                closing = true;
+        }
+        queue_ready.notify_one();
+        if (writer.joinable())
+                writer.join();
+}
+
+void AsyncLineWriter::run() {
+        vector<vector<string>> batches;
+        while (true) {
+                {
+                        unique_lock<mutex> guard(queue_lock);
+                        queue_ready.wait(guard, [this] { return closing || !queue.empty(); });
+                        if (queue.empty())
+                                break;
+                        batches.swap(queue);
+                }
+                unique_lock<mutex> stream_guard;
+                if (stream_lock)
+                        stream_guard = unique_lock<mutex>(*stream_lock);
+                for (auto &batch : batches) {
+                        for (auto &line : batch) {
+                                if (!unique) {
+                                        *out << line << '\n';
+                                        continue;
+                                }
+                                const auto &inserted = written.insert(move(line));
+                                if (inserted.second)
+                                        *out << *inserted.first << '\n';
+                        }
+                }
+                batches.clear();
+                out->flush();
+        }
+}
+
+void AsyncLineWriter::Buffer::write(string line) {
+        bytes += line.size() + 1;
+        lines.push_back(move(line));
+        if (bytes >= BATCH_BYTES)
+                flush();
+}
+
+void AsyncLineWriter::Buffer::flush() {
+        if (lines.empty())
+                return;
+        writer.submit(move(lines));
+        lines.clear();
+        bytes = 0;
+}
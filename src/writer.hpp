@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Writes lines to a file from a background thread.
+ *
+ * Worker threads collect their lines in a Buffer each and hand them over in
+ * batches, so they neither block on the file nor contend for a lock per
+ * line. Lines are written in the order their batches arrive, and the output
+ * is flushed whenever the queue runs dry, so readers see them promptly.
+ */
+class AsyncLineWriter {
+      public:
+        // Opens path for writing, truncating it. If unique, a line that was
+        // already written is dropped.
+        AsyncLineWriter(const string &path, bool unique);
+
+        // Writes to stream, e.g. cout, which must outlive the writer. If
+        // stream_lock is given, it is held while writing, so that lines other
+        // threads write to stream under it are not split.
+        AsyncLineWriter(ostream &stream, bool unique, mutex *stream_lock = nullptr);
+
+        ~AsyncLineWriter();
+
+        AsyncLineWriter(const AsyncLineWriter &) = delete;
+        AsyncLineWriter &operator=(const AsyncLineWriter &) = delete;
+
+        // Returns if the file could be opened.
+        bool ok() const { return static_cast<bool>(*out); }
+
+        // Queues lines to be written.
+        void submit(vector<string> &&lines);
+
+        // Writes the queued lines, then stops the writer thread. Buffers
+        // must be flushed first.
+        void close();
+
+        // Collects the lines of one thread.
+        class Buffer {
+              public:
+                explicit Buffer(AsyncLineWriter &writer) : writer(writer) {}
+                ~Buffer() { flush(); }
+
+                Buffer(const Buffer &) = delete;
+                Buffer &operator=(const Buffer &) = delete;
+
+                void write(string line);
+
+                // Hands the collected lines to the writer.
+                void flush();
+
+              private:
+                // the number of bytes collected before they are handed over
+                static const size_t BATCH_BYTES = 64 * 1024;
+
+                AsyncLineWriter &writer;
+                vector<string> lines;
+                size_t bytes = 0;
+        };
+
+      private:
+        void run();
+
+        ofstream file;
+        ostream *out;
+        mutex *stream_lock = nullptr;
+        bool unique;
+
+        // the lines written so far, if unique; only used by the writer thread
+        unordered_set<string> written;
+
+        mutex queue_lock;
+        condition_variable queue_ready;
+        vector<vector<string>> queue;
+        bool closing = false;
+
+        thread writer;
+};